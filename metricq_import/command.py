@@ -100,6 +100,37 @@ def command(name=""):
             help="Ignore timestamps that are totally far in the future from broken sources",
         )
         @click.option("--resume", is_flag=True, default=False, show_default=True)
+        @click.option(
+            "--resync",
+            is_flag=True,
+            default=False,
+            help="Append new values to previously imported metrics, skip unchanged tables",
+        )
+        @click.option(
+            "--profile",
+            is_flag=True,
+            default=False,
+            help="Store value, interval and gap profiles with each import",
+        )
+        @click.option(
+            "--ledger-interval",
+            default=5.0,
+            type=float,
+            show_default=True,
+            help="Seconds between the bulk writes of the import records to CouchDB",
+        )
+        @click.option(
+            "--ledger-journal",
+            default=None,
+            help="Local journal of the import records not yet written to CouchDB"
+            " (default: metricq-import-<token>.journal)",
+        )
+        @click.option(
+            "--numa",
+            is_flag=True,
+            default=False,
+            help="Pin each import to the CPUs of one NUMA node, spread over the nodes",
+        )
         @click_log.simple_verbosity_option(logger)
         def wrapper(
             metricq_token,
@@ -121,6 +152,11 @@ def command(name=""):
             quiet,
             ignore_out_of_range_timestamps,
             resume,
+            resync,
+            profile,
+            ledger_interval,
+            ledger_journal,
+            numa,
             **kwargs
         ):
             importer = DataheapToHTAImporter(
@@ -143,6 +179,11 @@ def command(name=""):
                 assume_yes=assume_yes,
                 ignore_out_of_range_timestamps=ignore_out_of_range_timestamps,
                 resume=resume,
+                resync=resync,
+                profile=profile,
+                ledger_interval=ledger_interval,
+                ledger_journal=ledger_journal,
+                numa=numa,
             )
             return func(importer, **kwargs)
 
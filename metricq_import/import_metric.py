@@ -3,6 +3,10 @@ from datetime import timedelta
 import click
 
 
+# priority classes, metrics of a higher class are imported first
+PRIORITIES = ("high", "normal", "low")
+
+
 class ImportMetric(object):
     def __init__(
         self,
@@ -13,7 +17,12 @@ class ImportMetric(object):
         interval_factor=10,
         interval_min=None,
         interval_max=None,
+        priority="normal",
     ):
+        if priority not in PRIORITIES:
+            raise ValueError(f"[{metricq_name}] unknown priority {priority}")
+        self.priority = priority
+
         self.metricq_name = metricq_name
         self.import_name = import_name
         self.dataheap_name = dataheap_name
@@ -51,6 +60,11 @@ class ImportMetric(object):
                 return i
             i *= self.interval_factor
 
+    @property
+    def priority_rank(self):
+        """Lower ranks are more important."""
+        return PRIORITIES.index(self.priority)
+
     @property
     def config(self):
         return {
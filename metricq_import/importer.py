@@ -22,9 +22,18 @@
 
 
 import asyncio
+import collections
+import concurrent.futures
+import contextlib
 import datetime
+import functools
+import heapq
+import itertools
 import json
 import os
+import shutil
+import signal
+import socket
 import subprocess
 import tempfile
 
@@ -37,6 +46,13 @@ from metricq.logging import get_logger
 from metricq.types import Timestamp
 
 from .import_metric import ImportMetric
+from .ledger import ImportLedger
+
+try:
+    # embedded import engine, built with -DHTA_IMPORT_PYTHON=ON
+    import hta_import
+except ImportError:
+    hta_import = None
 
 logger = get_logger()
 
@@ -83,6 +99,11 @@ class DataheapToHTAImporter(object):
         assume_yes: bool = False,
         ignore_out_of_range_timestamps: bool = False,
         resume: bool = False,
+        resync: bool = False,
+        profile: bool = False,
+        ledger_interval: float = 5.0,
+        ledger_journal: str = None,
+        numa: bool = False,
     ):
         self._metricq_url = metricq_url
         self._metricq_token = metricq_token
@@ -94,8 +115,24 @@ class DataheapToHTAImporter(object):
         self.couchdb_db_config = self._couchdb_client.create_database("config")
         self.couchdb_db_import = self._couchdb_client.create_database("import")
         self.couchdb_db_meta = self._couchdb_client.create_database("metadata")
+        # the import records are written in bulk, the journal keeps them across crashes
+        self._ledger = ImportLedger(
+            self.couchdb_db_import,
+            ledger_journal or f"metricq-import-{metricq_token}.journal",
+            ledger_interval,
+        )
+
+        # imports that run at a time, the extra workers stand in for paused imports
+        self._num_slots = import_workers
+        self._num_workers = 2 * import_workers
 
-        self._num_workers = import_workers
+        # the embedded engine runs the imports in these threads instead of subprocesses
+        self._engine = None
+        if hta_import is not None:
+            self._engine = hta_import.Engine()
+            self._executor = concurrent.futures.ThreadPoolExecutor(
+                max_workers=self._num_workers
+            )
 
         self._import_host = import_host
         self._import_port = import_port
@@ -119,6 +156,26 @@ class DataheapToHTAImporter(object):
         self._assume_yes = assume_yes
         self._ignore_out_of_range_timestamps = ignore_out_of_range_timestamps
         self._resume = resume
+        self._resync = resync
+        self._profile = profile
+        # pipeline indexes of the running imports, each one pins its NUMA node
+        self._numa = numa
+        self._pipelines = set()
+        # source table fingerprints taken at the begin of the import
+        self._fingerprints = {}
+        # metricq name => metric whose source table is an exact copy of this one's
+        self._duplicates = {}
+        # metricq name => event that is set once the import of the metric has finished
+        self._imported = {}
+        # import slots: free ones, and a heap of (rank, new, sequence, future) waiting
+        self._free_slots = self._num_slots
+        self._waiting = []
+        self._sequence = itertools.count()
+        # metricq name => (priority rank, pause, resume) of the imports holding a slot,
+        # pause and resume are None until the import can handle them
+        self._running = {}
+        # metricq name => (priority rank, pause, resume, task waiting to resume it)
+        self._paused = {}
 
         if not self._dry_run and not self._metricq_token:
             raise ValueError("Must specify metricq-token unless dry-run")
@@ -154,9 +211,14 @@ class DataheapToHTAImporter(object):
         )
 
         self._update_config()
-        if not self._resume:
+        self._ledger.load(metric.metricq_name for metric in self.import_metrics)
+        if not (self._resume or self._resync):
             self._create_bindings()
+        # taken before the end of the import range: an unchanged fingerprint at the next
+        # resync then guarantees that no rows were written after synced_until
+        self._fingerprints = self._fingerprint_tables()
         self._import_begin = Timestamp.now()
+        self._duplicates = self._find_duplicates()
         self._run_import()
 
         if self._failed_imports:
@@ -165,13 +227,7 @@ class DataheapToHTAImporter(object):
                 print(f" - {metric.metricq_name}")
 
     def dry_run(self):
-        mysql = pymysql.connect(
-            host=self._import_host,
-            port=self._import_port,
-            user=self._import_user,
-            passwd=self._import_password,
-            db=self._import_database,
-        )
+        mysql = self._connect_mysql()
         counts = {}
         for metric in self._metrics:
             with mysql.cursor() as cursor:
@@ -262,7 +318,7 @@ class DataheapToHTAImporter(object):
         current_config = dict(config_document)
         current_metrics = current_config["metrics"]
 
-        if not self._resume:
+        if not (self._resume or self._resync):
             current_metric_names = list(current_metrics.keys())
             conflicting_metrics = [
                 metric
@@ -300,6 +356,141 @@ class DataheapToHTAImporter(object):
             },
         }
 
+    def _connect_mysql(self):
+        return pymysql.connect(
+            host=self._import_host,
+            port=self._import_port,
+            user=self._import_user,
+            passwd=self._import_password,
+            db=self._import_database,
+        )
+
+    def _fingerprint_tables(self):
+        """Cheap change detection for the source tables.
+
+        The update time and row estimate come from one information_schema query for
+        all tables, the maximum timestamp is an index lookup per table. A table with an
+        unchanged fingerprint has no new rows since the last sync.
+        """
+        mysql = self._connect_mysql()
+        fingerprints = {}
+        with mysql.cursor() as cursor:
+            cursor.execute(
+                "SELECT TABLE_NAME, UPDATE_TIME, TABLE_ROWS FROM information_schema.TABLES"
+                " WHERE TABLE_SCHEMA = %s",
+                (self._import_database,),
+            )
+            for table, update_time, rows in cursor.fetchall():
+                fingerprints[table] = {
+                    "update_time": update_time.isoformat() if update_time else None,
+                    "rows": rows,
+                }
+            for metric in self.import_metrics:
+                fingerprint = fingerprints.get(metric.import_name)
+                if fingerprint is None:
+                    continue
+                cursor.execute(f"SELECT MAX(timestamp) FROM `{metric.import_name}`")
+                (fingerprint["max_timestamp"],) = cursor.fetchone()
+        mysql.close()
+        return fingerprints
+
+    # time ranges sampled per table when looking for copies, and rows per range
+    DUPLICATE_SAMPLES = 4
+    DUPLICATE_SAMPLE_ROWS = 1000
+
+    def _find_duplicates(self):
+        """Find source tables that are probably copies of another one in the import set.
+
+        Only tables with the same maximum timestamp and HTA configuration are
+        candidates. Those are compared by their minimum timestamp and by the count and
+        hash of the rows in a few time ranges, all index range scans of a bounded size.
+        The complete tables are only compared by _confirm_duplicate, right before the
+        copy would be made, by their live checksums. Each distinct series is imported once, the copies are
+        materialized from its HTA files.
+        """
+        candidates = collections.defaultdict(list)
+        for metric in self.import_metrics:
+            fingerprint = self._fingerprints.get(metric.import_name)
+            if not fingerprint or fingerprint.get("max_timestamp") is None:
+                continue
+            config = json.dumps(metric.config, sort_keys=True)
+            candidates[(fingerprint["max_timestamp"], config)].append(metric)
+        if all(len(group) < 2 for group in candidates.values()):
+            return {}
+
+        duplicates = {}
+        mysql = self._connect_mysql()
+        with mysql.cursor() as cursor:
+            for (max_timestamp, _), group in candidates.items():
+                if len(group) < 2:
+                    continue
+                first = {}
+                for metric in group:
+                    sample = self._sample_table(
+                        cursor, metric.import_name, max_timestamp
+                    )
+                    source = first.setdefault(sample, metric)
+                    if source is not metric:
+                        logger.info(
+                            f"[{metric.metricq_name}] probably a copy of "
+                            f"{source.metricq_name}"
+                        )
+                        duplicates[metric.metricq_name] = source
+        mysql.close()
+        return duplicates
+
+    def _sample_table(self, cursor, table, max_timestamp):
+        cursor.execute(f"SELECT MIN(timestamp) FROM `{table}`")
+        (min_timestamp,) = cursor.fetchone()
+        sample = [min_timestamp]
+        if min_timestamp is None:
+            return tuple(sample)
+        step = (max_timestamp - min_timestamp) // self.DUPLICATE_SAMPLES
+        for index in range(self.DUPLICATE_SAMPLES):
+            cursor.execute(
+                "SELECT COUNT(*), BIT_XOR(CRC32(CONCAT(timestamp, ' ', value)))"
+                f" FROM (SELECT timestamp, value FROM `{table}` WHERE timestamp >= %s"
+                " ORDER BY timestamp LIMIT %s) AS sample",
+                (min_timestamp + index * step, self.DUPLICATE_SAMPLE_ROWS),
+            )
+            sample.extend(cursor.fetchone())
+        return tuple(sample)
+
+    def _checksum_tables(self, tables):
+        mysql = self._connect_mysql()
+        try:
+            with mysql.cursor() as cursor:
+                # only the checksums the engine keeps up to date, NULL for the others
+                cursor.execute(
+                    "CHECKSUM TABLE "
+                    + ", ".join(f"`{table}`" for table in tables)
+                    + " QUICK"
+                )
+                return [checksum for _, checksum in cursor.fetchall()]
+        finally:
+            mysql.close()
+
+    async def _confirm_duplicate(self, metric, source):
+        """Compare the complete tables by the live checksums of their engine (CHECKSUM=1
+        tables of MyISAM and Aria). Computing a checksum would read all rows, more than
+        importing the copy, so a table without one is imported."""
+        checksums = await asyncio.get_running_loop().run_in_executor(
+            None, self._checksum_tables, [metric.import_name, source.import_name]
+        )
+        if checksums[0] is None or checksums[1] is None:
+            logger.info(
+                f"[{metric.metricq_name}] no live checksum to confirm it is a copy of "
+                f"{source.metricq_name}, importing it"
+            )
+            return False
+        if checksums[0] != checksums[1]:
+            logger.info(
+                f"[{metric.metricq_name}] not a copy of {source.metricq_name},"
+                " importing it"
+            )
+            return False
+        return True
+
     def _create_bindings(self):
         fake_agent = FakeAgent(self._metricq_token, self._metricq_url)
         fake_agent.run()
@@ -311,9 +502,19 @@ class DataheapToHTAImporter(object):
 
     def _run_import(self):
         # setup task queue
-        self.queue = asyncio.Queue()
-        for metric in self.import_metrics:
-            self.queue.put_nowait(metric)
+        self.queue = asyncio.PriorityQueue()
+        # a source is imported at the priority of its most important duplicate,
+        # duplicates go after their source within the same class
+        ranks = {
+            metric.metricq_name: metric.priority_rank for metric in self.import_metrics
+        }
+        for name, source in self._duplicates.items():
+            ranks[source.metricq_name] = min(ranks[source.metricq_name], ranks[name])
+        for index, metric in enumerate(self.import_metrics):
+            is_duplicate = metric.metricq_name in self._duplicates
+            self.queue.put_nowait(
+                (ranks[metric.metricq_name], is_duplicate, index, metric)
+            )
         self.num_import_metrics = self.queue.qsize()
 
         # run all pending import tasks
@@ -327,45 +528,281 @@ class DataheapToHTAImporter(object):
     async def import_worker(self, bar):
         while True:
             try:
-                metric = self.queue.get_nowait()
+                *_, metric = self.queue.get_nowait()
             except asyncio.QueueEmpty:
                 return
-            await self.import_metric(metric)
+            try:
+                await self.import_metric(metric)
+            except Exception:
+                # its copies must not be made from a missing or partial import
+                self._failed_imports.append(metric)
+                raise
+            finally:
+                self._imported[metric.metricq_name].set()
             self._last_completed_metric = metric
             bar.update(1)
 
     async def import_main(self, bar):
+        self._imported = {
+            metric.metricq_name: asyncio.Event() for metric in self.import_metrics
+        }
+        ledger = asyncio.create_task(self._ledger.run())
         workers = [self.import_worker(bar) for _ in range(self._num_workers)]
-        await asyncio.wait(workers)
+        try:
+            await asyncio.wait(workers)
+        finally:
+            self._ledger.stop()
+            await ledger
 
     async def import_metric(self, metric):
-        if self._resume:
-            try:
-                old_import = self.couchdb_db_import[metric.metricq_name]
-                old_import.fetch()
-                if old_import.get("return_code", -1) != 0:
-                    click.echo(
-                        f"{metric.metricq_name} was partially imported, please cleanup"
-                    )
-                    raise RuntimeError("partial import")
-                else:
-                    click.echo(f"{metric.metricq_name} successfully imported, continue")
-                    return
-            except KeyError:
-                pass
+        old_import = None
+        if self._resume or self._resync:
+            old_import = self._ledger.get(metric.metricq_name)
+
+        fingerprint = self._fingerprints.get(metric.import_name)
+        min_timestamp = 0
+        if old_import is not None:
+            if old_import.get("return_code", -1) != 0:
+                click.echo(
+                    f"{metric.metricq_name} was partially imported, please cleanup"
+                )
+                raise RuntimeError("partial import")
+            if not self._resync:
+                click.echo(f"{metric.metricq_name} successfully imported, continue")
+                return
+            if fingerprint is not None and old_import.get("fingerprint") == fingerprint:
+                logger.debug(f"[{metric.metricq_name}] unchanged since last sync")
+                return
+            # continue exactly where the last sync stopped
+            min_timestamp = old_import.get("synced_until", 0)
+
+        config = self.import_config.copy()
+        metric_config = metric.config
+        metric_config["name"] = metric.metricq_name
+        config["metrics"] = [metric_config]
 
+        import_data = {
+            "_id": metric.metricq_name,
+            "import_name": metric.import_name,
+            "dataheap_name": metric.dataheap_name,
+            "begin": datetime.datetime.utcnow()
+            .replace(tzinfo=datetime.timezone.utc)
+            .isoformat(),
+            "config": config,
+            "host": socket.gethostname(),
+            "fingerprint": fingerprint,
+            "synced_until": int(self._import_begin.posix_ms),
+        }
+        if min_timestamp:
+            import_data["min_timestamp"] = min_timestamp
+
+        source = self._duplicates.get(metric.metricq_name)
+        if source is not None and not await self._confirm_duplicate(metric, source):
+            source = None
+        if source is not None:
+            import_data["duplicate_of"] = source.metricq_name
+            import_doc = await self._save_import_doc(import_data, old_import)
+            return_code, resources = await self._copy_duplicate(metric, source), None
+        elif self._engine is not None:
+            import_data["engine"] = "embedded"
+            import_doc = await self._save_import_doc(import_data, old_import)
+            return_code, resources = await self._import_embedded(
+                metric, config, min_timestamp
+            )
+        else:
+            import_doc, return_code, resources = await self._import_subprocess(
+                metric, config, import_data, old_import, min_timestamp
+            )
+            if return_code is None:
+                self._failed_imports.append(metric)
+                return
+
+        import_doc["return_code"] = return_code
+        import_doc["end"] = (
+            datetime.datetime.utcnow().replace(tzinfo=datetime.timezone.utc).isoformat()
+        )
+        if resources is not None:
+            # the data profile is a result of its own, not a resource
+            profile = resources.pop("profile", None)
+            if profile is not None:
+                import_doc["profile"] = profile
+            import_doc["resources"] = resources
+        await self._ledger.put(import_doc)
+
+        if return_code != 0:
+            self._failed_imports.append(metric)
+
+    async def _save_import_doc(self, import_data, old_import):
+        if old_import is None:
+            # only a resume or resync may replace the record of an earlier import
+            import_doc = dict(import_data)
+            await self._ledger.create(import_doc)
+        else:
+            # a resync replaces the record of the previous run
+            import_doc = old_import
+            for key in ("return_code", "end", "resources", "profile", "min_timestamp"):
+                import_doc.pop(key, None)
+            import_doc.update(import_data)
+            await self._ledger.put(import_doc)
+        return import_doc
+
+    async def _copy_duplicate(self, metric, source):
+        await self._imported[source.metricq_name].wait()
+        if source in self._failed_imports:
+            logger.error(f"[{metric.metricq_name}] {source.metricq_name} failed")
+            return -1
+
+        path = self.import_config["path"]
+        target = os.path.join(path, metric.metricq_name)
+        # a resync replaces the previous copy as a whole
+        shutil.rmtree(target, ignore_errors=True)
+        process = await asyncio.create_subprocess_exec(
+            "cp",
+            "-r",
+            "--reflink=auto",
+            os.path.join(path, source.metricq_name),
+            target,
+        )
+        return await process.wait()
+
+    async def _acquire_slot(self, rank, resumes=False):
+        if self._free_slots > 0 and not self._waiting:
+            self._free_slots -= 1
+            return
+        slot = asyncio.get_running_loop().create_future()
+        # within a priority class, paused imports go first
+        heapq.heappush(self._waiting, (rank, not resumes, next(self._sequence), slot))
+        self._preempt()
+        try:
+            await slot
+        except asyncio.CancelledError:
+            if slot.done() and not slot.cancelled():
+                self._release_slot()
+            raise
+
+    def _release_slot(self):
+        while self._waiting:
+            *_, slot = heapq.heappop(self._waiting)
+            if not slot.done():
+                slot.set_result(None)
+                return
+        self._free_slots += 1
+
+    @contextlib.asynccontextmanager
+    async def _slot(self, metric):
+        """Holds an import slot, for the whole import unless it is paused meanwhile."""
+        await self._acquire_slot(metric.priority_rank)
+        self._running[metric.metricq_name] = (metric.priority_rank, None, None)
+        try:
+            yield
+        finally:
+            name = metric.metricq_name
+            if self._running.pop(name, None) is not None:
+                self._release_slot()
+            elif name in self._paused:
+                # finished before it reached the chunk boundary, its slot is handed over
+                *_, resuming = self._paused.pop(name)
+                resuming.cancel()
+
+    @contextlib.contextmanager
+    def _pipeline(self):
+        """The lowest pipeline index not used by a running import, so that the imports that
+        run at a time are spread evenly over the NUMA nodes."""
+        pipeline = next(i for i in itertools.count() if i not in self._pipelines)
+        self._pipelines.add(pipeline)
+        try:
+            yield pipeline
+        finally:
+            self._pipelines.discard(pipeline)
+
+    def _pausable(self, metric, pause, resume):
+        self._running[metric.metricq_name] = (metric.priority_rank, pause, resume)
+        self._preempt()
+
+    def _preempt(self):
+        """Pause imports at their next chunk boundary while imports of a higher priority
+        class wait for a slot, and hand the slots of the paused imports to those.
+
+        As the queue is sorted by class, this only happens if a lower class took a slot
+        while the worker of a higher one was still checking its fingerprint or duplicate.
+        A paused import closes its source connections, but keeps its worker and its open
+        HTA files until it resumes."""
+        while self._waiting:
+            if self._waiting[0][-1].done():
+                heapq.heappop(self._waiting)
+                continue
+            pausable = [
+                (rank, name)
+                for name, (rank, pause, _) in self._running.items()
+                if pause is not None and rank > self._waiting[0][0]
+            ]
+            if not pausable:
+                return
+            _, name = max(pausable)
+            rank, pause, resume = self._running.pop(name)
+            logger.info(f"[{name}] paused for a higher priority import")
+            pause()
+            resuming = asyncio.create_task(self._resume(name, rank))
+            self._paused[name] = (rank, pause, resume, resuming)
+            self._release_slot()
+
+    async def _resume(self, name, rank):
+        await self._acquire_slot(rank, resumes=True)
+        rank, pause, resume, _ = self._paused.pop(name)
+        logger.info(f"[{name}] resumed")
+        resume()
+        self._running[name] = (rank, pause, resume)
+
+    async def _import_embedded(self, metric, config, min_timestamp):
+        job = hta_import.Job()
+
+        def progress(rows, timestamp):
+            logger.debug(f"[{metric.metricq_name}] {rows:,} rows imported")
+
+        run = functools.partial(
+            self._engine.run,
+            job,
+            json.dumps(config),
+            metric.metricq_name,
+            metric.import_name,
+            min_timestamp=min_timestamp,
+            max_timestamp=int(self._import_begin.posix_ms),
+            profile=self._profile,
+            numa=self._numa,
+            progress=progress,
+        )
+        async with self._slot(metric), self._pipeline() as pipeline:
+            self._pausable(metric, job.pause, job.resume)
+            try:
+                report = await asyncio.get_running_loop().run_in_executor(
+                    self._executor, functools.partial(run, pipeline=pipeline)
+                )
+            except asyncio.CancelledError:
+                job.stop()
+                raise
+
+        report = json.loads(report)
+        if "error" in report:
+            logger.error(f"[{metric.metricq_name}] import failed: {report['error']}")
+            return -1, report
+        return 0, report
+
+    async def _import_subprocess(
+        self, metric, config, import_data, old_import, min_timestamp
+    ):
         # write config into a tmpfile
         conffile, conffile_name = tempfile.mkstemp(
             prefix="metricq-import-", suffix=".json", text=True
         )
         with open(conffile, "w") as conf:
-            config = self.import_config.copy()
-            config["metrics"] = []
-            metric_config = metric.config
-            metric_config["name"] = metric.metricq_name
-            config["metrics"].append(metric_config)
             json.dump(config, conf)
 
+        # the importer writes its resource usage into this file when it finishes
+        reportfile, reportfile_name = tempfile.mkstemp(
+            prefix="metricq-import-report-", suffix=".json"
+        )
+        os.close(reportfile)
+
         args = (
             "hta_mysql_import",
             "-m",
@@ -374,46 +811,65 @@ class DataheapToHTAImporter(object):
             metric.import_name,
             "-c",
             conffile_name,
+            "--min-timestamp",
+            str(min_timestamp),
             "--max-timestamp",
             str(int(self._import_begin.posix_ms)),
+            "--report",
+            reportfile_name,
         )
+        if self._profile:
+            # the profile is part of the report as well
+            args += ("--profile", os.devnull)
+        import_data["arguments"] = args
 
-        import_data = {
-            "_id": metric.metricq_name,
-            "import_name": metric.import_name,
-            "dataheap_name": metric.dataheap_name,
-            "begin": datetime.datetime.utcnow()
-            .replace(tzinfo=datetime.timezone.utc)
-            .isoformat(),
-            "arguments": args,
-            "config": config,
-        }
-
-        import_doc = self.couchdb_db_import.create_document(import_data)
-        import_doc.save()
+        import_doc = await self._save_import_doc(import_data, old_import)
 
+        return_code, resources = None, None
         try:
-            process = await asyncio.create_subprocess_exec(
-                *args, stdout=subprocess.PIPE
-            )
-
-            await process.communicate()
-
-            import_doc["return_code"] = process.returncode
-            import_doc["end"] = (
-                datetime.datetime.utcnow()
-                .replace(tzinfo=datetime.timezone.utc)
-                .isoformat()
-            )
-            import_doc.save()
+            async with self._slot(metric), self._pipeline() as pipeline:
+                numa_args = ("--numa", "--pipeline", str(pipeline)) if self._numa else ()
+                process = await asyncio.create_subprocess_exec(
+                    *args, *numa_args, stdout=subprocess.PIPE
+                )
 
-            if process.returncode != 0:
-                self._failed_imports.append(metric)
+                def send_signal(signum):
+                    try:
+                        process.send_signal(signum)
+                    except ProcessLookupError:
+                        pass
+
+                # Until its handlers are installed, the signals would terminate it.
+                # hta_mysql_import then pauses at the next chunk boundary on SIGUSR1.
+                ready = f"[{metric.metricq_name}] ready".encode()
+                async for line in process.stdout:
+                    if line.rstrip() == ready:
+                        self._pausable(
+                            metric,
+                            functools.partial(send_signal, signal.SIGUSR1),
+                            functools.partial(send_signal, signal.SIGUSR2),
+                        )
+                        break
+                await process.communicate()
+
+            return_code = process.returncode
+            resources = self._read_report(reportfile_name)
         except FileNotFoundError:
             logger.error("Make sure hta_mysql_import is in your PATH.")
 
+        for tmpfile_name in (conffile_name, reportfile_name):
+            try:
+                os.remove(tmpfile_name)
+            except OSError:
+                pass
+
+        return import_doc, return_code, resources
+
+    @staticmethod
+    def _read_report(reportfile_name):
         try:
-            os.remove(conffile_name)
-            pass
-        except OSError:
-            pass
+            with open(reportfile_name) as report:
+                return json.load(report)
+        except (OSError, ValueError):
+            logger.warn(f"No resource report in {reportfile_name}")
+            return None
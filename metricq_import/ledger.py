@@ -0,0 +1,234 @@
+# metricq
+# Copyright (C) 2019 ZIH,
+# Technische Universitaet Dresden,
+# Federal Republic of Germany
+#
+# All rights reserved.
+#
+# This file is part of metricq.
+#
+# metricq is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# metricq is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with metricq.  If not, see <http://www.gnu.org/licenses/>.
+
+
+import asyncio
+import concurrent.futures
+import json
+import os
+import threading
+
+from metricq.logging import get_logger
+
+logger = get_logger()
+
+
+class ImportLedger(object):
+    """Buffered job documents of the CouchDB import database.
+
+    The documents are read with one bulk request per batch of metrics and written
+    with bulk requests at most every `interval` seconds, so an import does not wait
+    for a round trip to CouchDB at its begin and end. Every update is appended to a
+    local journal before it is acknowledged. After a crash, the journal is replayed on
+    load, so no state written before the crash is lost. The journal is written by a
+    thread of its own, the updates that arrive during an fsync share the next one.
+    """
+
+    # documents per bulk request
+    batch_size = 1000
+
+    def __init__(self, db, journal_path: str, interval: float = 5.0):
+        self._db = db
+        self._journal_path = journal_path
+        self._interval = interval
+        self._journal = None
+        # journal lines not written yet, and the thread that writes and syncs them
+        self._unsynced = []
+        # while a compaction is queued, lines of later updates are held back for the new
+        # journal, the old one is replaced by a snapshot that does not know them
+        self._deferred = None
+        self._unsynced_lock = threading.Lock()
+        self._journal_executor = concurrent.futures.ThreadPoolExecutor(max_workers=1)
+        # id => current state of the document, including its _rev if it is stored
+        self._docs = {}
+        self._pending = set()
+        self._stopped = None
+
+    def load(self, names):
+        """Read the stored documents of these metrics and replay the journal."""
+        names = list(names)
+        for begin in range(0, len(names), self.batch_size):
+            result = self._db.all_docs(
+                keys=names[begin : begin + self.batch_size], include_docs=True
+            )
+            for row in result["rows"]:
+                if row.get("doc") is not None:
+                    self._docs[row["id"]] = row["doc"]
+
+        if os.path.exists(self._journal_path):
+            replayed = 0
+            with open(self._journal_path) as journal:
+                for line in journal:
+                    try:
+                        doc = json.loads(line)
+                    except ValueError:
+                        # torn last line of a crash
+                        continue
+                    self._replace(doc)
+                    replayed += 1
+            logger.warn(
+                f"Replayed {replayed} import records from {self._journal_path}, "
+                "the previous run did not finish"
+            )
+        self._journal = open(self._journal_path, "a")
+
+    def get(self, name):
+        """The document of a metric, None if there is none."""
+        doc = self._docs.get(name)
+        return dict(doc) if doc is not None else None
+
+    async def create(self, doc):
+        """Add the document of a fresh import, raises if there is one with its _id."""
+        current = self._docs.get(doc["_id"])
+        if current is not None and "_rev" in current:
+            raise RuntimeError(f"[{doc['_id']}] there is already an import record")
+        await self.put(doc)
+
+    async def put(self, doc):
+        """Replace the document with the same _id, it is written by the next flush.
+        Returns once the update is in the journal."""
+        self._replace(doc)
+        with self._unsynced_lock:
+            lines = self._unsynced if self._deferred is None else self._deferred
+            lines.append(json.dumps(doc) + "\n")
+        await asyncio.get_running_loop().run_in_executor(
+            self._journal_executor, self._sync_journal
+        )
+
+    def _sync_journal(self):
+        with self._unsynced_lock:
+            lines, self._unsynced = self._unsynced, []
+        if not lines:
+            # written and synced along with an earlier update
+            return
+        self._journal.writelines(lines)
+        self._journal.flush()
+        os.fsync(self._journal.fileno())
+
+    def _replace(self, doc):
+        doc = dict(doc)
+        doc.pop("_rev", None)
+        current = self._docs.get(doc["_id"])
+        if current is not None and "_rev" in current:
+            doc["_rev"] = current["_rev"]
+        self._docs[doc["_id"]] = doc
+        self._pending.add(doc["_id"])
+
+    async def run(self):
+        """Flush at the configured interval until stop(), then write the rest."""
+        self._stopped = asyncio.Event()
+        while self._pending or not self._stopped.is_set():
+            try:
+                await asyncio.wait_for(self._stopped.wait(), self._interval)
+            except asyncio.TimeoutError:
+                pass
+            try:
+                await self._flush()
+            except Exception as e:
+                if self._stopped.is_set():
+                    # the journal is kept, the next run replays it
+                    raise
+                logger.error(
+                    f"Writing import records failed, retrying in {self._interval} s: {e}"
+                )
+        # everything is stored, a journal left behind means the run did not finish
+        await asyncio.get_running_loop().run_in_executor(
+            self._journal_executor, self._remove_journal
+        )
+
+    def _remove_journal(self):
+        self._journal.close()
+        os.remove(self._journal_path)
+
+    def stop(self):
+        self._stopped.set()
+
+    async def _flush(self):
+        if not self._pending:
+            return
+        docs = [dict(self._docs[name]) for name in self._pending]
+        self._pending.clear()
+        # the requests block, documents updated meanwhile stay pending
+        try:
+            revisions, conflicts = await asyncio.get_running_loop().run_in_executor(
+                None, self._write, docs
+            )
+        except Exception:
+            # still in the journal, written by the next flush
+            self._pending.update(doc["_id"] for doc in docs)
+            raise
+        for name, rev in revisions.items():
+            self._docs[name]["_rev"] = rev
+        for name in conflicts:
+            if "_rev" in self._docs[name]:
+                # retried with the current revision by the next flush
+                self._pending.add(name)
+            else:
+                # created by someone else meanwhile, as for a fresh run on a stored one
+                logger.error(f"[{name}] import record exists already, not replaced")
+        # lines queued before are synced to the old journal and covered by the snapshot, the
+        # ones queued from now on follow the snapshot in the new journal
+        snapshot = [json.dumps(self._docs[name]) + "\n" for name in self._pending]
+        with self._unsynced_lock:
+            self._deferred = []
+        await asyncio.get_running_loop().run_in_executor(
+            self._journal_executor, self._compact_journal, snapshot
+        )
+
+    def _write(self, docs):
+        revisions, conflicts = {}, []
+        for begin in range(0, len(docs), self.batch_size):
+            for result in self._db.bulk_docs(docs[begin : begin + self.batch_size]):
+                if "rev" in result:
+                    revisions[result["id"]] = result["rev"]
+                elif result.get("error") == "conflict":
+                    conflicts.append(result["id"])
+                else:
+                    raise RuntimeError(
+                        f"[{result['id']}] import record not written: "
+                        f"{result.get('error')} {result.get('reason')}"
+                    )
+        # an update of a document changed by someone else takes over its revision
+        conflicting = set(conflicts)
+        updated = [
+            doc["_id"] for doc in docs if doc["_id"] in conflicting and "_rev" in doc
+        ]
+        if updated:
+            logger.warn(f"Import records changed concurrently: {', '.join(updated)}")
+            for row in self._db.all_docs(keys=updated)["rows"]:
+                if "value" in row:
+                    revisions[row["id"]] = row["value"]["rev"]
+        return revisions, conflicts
+
+    def _compact_journal(self, lines):
+        """Keep only the documents that are not stored yet in the journal."""
+        with self._unsynced_lock:
+            lines = lines + self._deferred
+            self._deferred = None
+        temporary = self._journal_path + ".tmp"
+        with open(temporary, "w") as journal:
+            journal.writelines(lines)
+            journal.flush()
+            os.fsync(journal.fileno())
+        os.replace(temporary, self._journal_path)
+        self._journal.close()
+        self._journal = open(self._journal_path, "a")
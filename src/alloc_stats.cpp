@@ -0,0 +1,161 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "alloc_stats.hpp"
+
+#include <iostream>
+#include <new>
+
+#include <cstdlib>
+
+namespace alloc_stats
+{
+namespace
+{
+const char* phase_names[phase_count] = { "stats", "query", "decode", "insert", "flush" };
+
+double per_row(uint64_t allocations, uint64_t rows)
+{
+    return rows ? static_cast<double>(allocations) / rows : 0.;
+}
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const counters& c)
+{
+    return os << c.allocations << " (" << c.bytes << " B)";
+}
+
+void Accounting::end_chunk(uint64_t rows)
+{
+    counters chunk_total;
+    for (std::size_t i = 0; i < phase_count; i++)
+    {
+        chunk_total += chunk_[i];
+        total_[i] += chunk_[i];
+    }
+    if (chunks_++ > 0)
+    {
+        steady_ += chunk_total;
+        steady_rows_ += rows;
+    }
+
+    if (report_)
+    {
+        std::cout << "[" << name_ << "] allocations:";
+        for (std::size_t i = 0; i < phase_count; i++)
+        {
+            if (chunk_[i].allocations)
+            {
+                std::cout << " " << phase_names[i] << " " << chunk_[i];
+            }
+        }
+        std::cout << ", " << per_row(chunk_total.allocations, rows) << " per row" << std::endl;
+    }
+    chunk_ = {};
+}
+
+void Accounting::report_total(uint64_t rows) const
+{
+    if (!report_)
+    {
+        return;
+    }
+    counters total;
+    for (std::size_t i = 0; i < phase_count; i++)
+    {
+        std::cout << "[" << name_ << "] total allocations " << phase_names[i] << ": " << total_[i]
+                  << std::endl;
+        total += total_[i];
+    }
+    std::cout << "[" << name_ << "] total allocations: " << total << ", "
+              << per_row(total.allocations, rows) << " per row" << std::endl;
+    std::cout << "[" << name_ << "] steady-state allocations: " << steady_ << ", "
+              << per_row(steady_.allocations, steady_rows_) << " per row" << std::endl;
+}
+} // namespace alloc_stats
+
+#ifdef HTA_IMPORT_ALLOC_STATS
+thread_local uint64_t alloc_stats::allocations = 0;
+thread_local uint64_t alloc_stats::bytes = 0;
+
+// Replacements of the global allocation functions. The array and nothrow variants default to
+// calling these, so they are covered as well.
+namespace
+{
+inline void count(std::size_t size)
+{
+    alloc_stats::allocations++;
+    alloc_stats::bytes += size;
+}
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    count(size);
+    if (auto ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    count(size);
+    auto align = static_cast<std::size_t>(alignment);
+    // aligned_alloc requires the size to be a multiple of the alignment
+    auto padded = (size + align - 1) / align * align;
+    if (auto ptr = std::aligned_alloc(align, padded ? padded : align))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+#endif
@@ -0,0 +1,132 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <array>
+#include <ostream>
+#include <string>
+
+#include <cstdint>
+
+// Heap allocation accounting per thread. The counters are only fed if the binary is built with
+// HTA_IMPORT_ALLOC_STATS, which replaces the global operator new / delete.
+namespace alloc_stats
+{
+struct counters
+{
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+
+    counters& operator+=(const counters& other)
+    {
+        allocations += other.allocations;
+        bytes += other.bytes;
+        return *this;
+    }
+};
+
+inline counters operator-(const counters& lhs, const counters& rhs)
+{
+    return { lhs.allocations - rhs.allocations, lhs.bytes - rhs.bytes };
+}
+
+std::ostream& operator<<(std::ostream& os, const counters& c);
+
+#ifdef HTA_IMPORT_ALLOC_STATS
+extern thread_local uint64_t allocations;
+extern thread_local uint64_t bytes;
+
+constexpr bool available = true;
+
+inline counters now()
+{
+    return { allocations, bytes };
+}
+#else
+constexpr bool available = false;
+
+inline counters now()
+{
+    return {};
+}
+#endif
+
+enum class phase
+{
+    stats,
+    query,
+    decode,
+    insert,
+    flush,
+};
+
+constexpr std::size_t phase_count = 5;
+
+// Attributes the allocations of the import loop to phases and chunks.
+// Each call to account() charges everything since the previous call to the given phase.
+class Accounting
+{
+public:
+    Accounting(const std::string& name, bool report) : name_(name), report_(report)
+    {
+        mark_ = now();
+    }
+
+    // starts accounting on the calling thread, discarding everything since the last call
+    void restart()
+    {
+        mark_ = now();
+    }
+
+    void account(phase p)
+    {
+        auto current = now();
+        chunk_[static_cast<std::size_t>(p)] += current - mark_;
+        mark_ = current;
+    }
+
+    // Closes a chunk, the first chunk is considered warm-up and excluded from the
+    // steady-state numbers
+    void end_chunk(uint64_t rows);
+
+    void report_total(uint64_t rows) const;
+
+private:
+    std::string name_;
+    bool report_;
+    counters mark_;
+    std::array<counters, phase_count> chunk_;
+    std::array<counters, phase_count> total_;
+    uint64_t chunks_ = 0;
+    counters steady_;
+    uint64_t steady_rows_ = 0;
+};
+} // namespace alloc_stats
@@ -0,0 +1,131 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "arrow_sink.hpp"
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+
+#include <stdexcept>
+
+namespace
+{
+void check(const arrow::Status& status)
+{
+    if (!status.ok())
+    {
+        throw std::runtime_error("arrow: " + status.ToString());
+    }
+}
+
+template <typename T>
+T check(arrow::Result<T> result)
+{
+    check(result.status());
+    return std::move(result).ValueOrDie();
+}
+} // namespace
+
+ArrowSink::ArrowSink(const std::filesystem::path& directory, const std::string& metric)
+: metric_(metric), path_(directory / metric),
+  schema_(arrow::schema({ arrow::field("timestamp", arrow::timestamp(arrow::TimeUnit::NANO)),
+                          arrow::field("value", arrow::float64()) },
+                        arrow::key_value_metadata({ "metric" }, { metric })))
+{
+}
+
+ArrowSink::~ArrowSink() = default;
+
+void ArrowSink::open(hta::TimePoint first_time)
+{
+    std::filesystem::create_directories(path_);
+    auto file_name = path_ / (std::to_string(first_time.time_since_epoch().count()) + ".arrow");
+    file_ = check(arrow::io::FileOutputStream::Open(file_name.string()));
+    writer_ = check(arrow::ipc::MakeFileWriter(file_, schema_));
+}
+
+void ArrowSink::write(const Batch& batch)
+{
+    if (batch.values.empty())
+    {
+        return;
+    }
+    if (!writer_)
+    {
+        open(batch.values.front().time);
+    }
+
+    auto size = static_cast<int64_t>(batch.values.size());
+    arrow::TimestampBuilder time_builder(arrow::timestamp(arrow::TimeUnit::NANO),
+                                         arrow::default_memory_pool());
+    arrow::DoubleBuilder value_builder;
+    check(time_builder.Reserve(size));
+    check(value_builder.Reserve(size));
+    for (const auto& tv : batch.values)
+    {
+        time_builder.UnsafeAppend(tv.time.time_since_epoch().count());
+        value_builder.UnsafeAppend(tv.value);
+    }
+
+    std::shared_ptr<arrow::Array> times, values;
+    check(time_builder.Finish(&times));
+    check(value_builder.Finish(&values));
+    check(writer_->WriteRecordBatch(*arrow::RecordBatch::Make(schema_, size, { times, values })));
+}
+
+void ArrowSink::flush()
+{
+    if (file_)
+    {
+        check(file_->Flush());
+    }
+}
+
+void ArrowSink::close()
+{
+    if (writer_)
+    {
+        check(writer_->Close());
+        check(file_->Close());
+        writer_.reset();
+        file_.reset();
+    }
+}
+
+std::string ArrowSink::name() const
+{
+    return metric_ + " -> arrow:" + path_.parent_path().string();
+}
+
+std::filesystem::path ArrowSink::metric_path() const
+{
+    return path_;
+}
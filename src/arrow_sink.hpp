@@ -0,0 +1,76 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "sink.hpp"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+namespace arrow
+{
+class Schema;
+namespace io
+{
+class FileOutputStream;
+} // namespace io
+namespace ipc
+{
+class RecordBatchWriter;
+} // namespace ipc
+} // namespace arrow
+
+// Writes the values of a metric as an Arrow IPC file with a timestamp (ns) and a value column,
+// one record batch per pipeline batch. The file is named after the first timestamp, so repeated
+// imports of the same metric do not overwrite each other.
+class ArrowSink : public Sink
+{
+public:
+    ArrowSink(const std::filesystem::path& directory, const std::string& metric);
+    ~ArrowSink() override;
+
+    void write(const Batch& batch) override;
+    void flush() override;
+    void close() override;
+
+    std::string name() const override;
+    std::filesystem::path metric_path() const override;
+
+private:
+    void open(hta::TimePoint first_time);
+
+    std::string metric_;
+    std::filesystem::path path_;
+    std::shared_ptr<arrow::Schema> schema_;
+    std::shared_ptr<arrow::io::FileOutputStream> file_;
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> writer_;
+};
@@ -0,0 +1,707 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "binlog.hpp"
+#include "metric_cache.hpp"
+
+#include <hta/hta.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <system_error>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+    extern char** environ;
+}
+
+namespace binlog
+{
+namespace
+{
+bool starts_with(std::string_view s, std::string_view prefix)
+{
+    return s.substr(0, prefix.size()) == prefix;
+}
+
+uint64_t number_after(std::string_view line, std::string_view key)
+{
+    auto pos = line.find(key);
+    if (pos == std::string_view::npos)
+    {
+        return 0;
+    }
+    return std::strtoull(std::string(line.substr(pos + key.size())).c_str(), nullptr, 10);
+}
+
+// binlog event types, from libbinlogevents/include/binlog_event.h
+constexpr uint8_t table_map_event = 19;
+constexpr uint8_t write_rows_v1 = 23;
+constexpr uint8_t update_rows_v1 = 24;
+constexpr uint8_t delete_rows_v1 = 25;
+constexpr uint8_t write_rows_v2 = 30;
+constexpr uint8_t update_rows_v2 = 31;
+constexpr uint8_t delete_rows_v2 = 32;
+constexpr std::size_t event_header_size = 19;
+constexpr std::size_t checksum_size = 4;
+
+// column types
+constexpr uint8_t type_tiny = 1;
+constexpr uint8_t type_short = 2;
+constexpr uint8_t type_long = 3;
+constexpr uint8_t type_float = 4;
+constexpr uint8_t type_double = 5;
+constexpr uint8_t type_longlong = 8;
+constexpr uint8_t type_int24 = 9;
+
+// size in the row image, 0 for the types that cannot be decoded
+std::size_t column_size(uint8_t type)
+{
+    switch (type)
+    {
+    case type_tiny:
+        return 1;
+    case type_short:
+        return 2;
+    case type_int24:
+        return 3;
+    case type_long:
+    case type_float:
+        return 4;
+    case type_longlong:
+    case type_double:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+std::string base64_decode(std::string_view text)
+{
+    static const std::string_view alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+    result.reserve(text.size() / 4 * 3);
+    uint32_t bits = 0;
+    int count = 0;
+    for (auto c : text)
+    {
+        auto index = alphabet.find(c);
+        if (index == std::string_view::npos)
+        {
+            // line breaks and padding
+            continue;
+        }
+        bits = (bits << 6) | index;
+        count += 6;
+        if (count >= 8)
+        {
+            count -= 8;
+            result.push_back(static_cast<char>((bits >> count) & 0xff));
+        }
+    }
+    return result;
+}
+
+bool bit(std::string_view bitmap, std::size_t index)
+{
+    return (static_cast<uint8_t>(bitmap[index / 8]) >> (index % 8)) & 1;
+}
+
+// little endian fields of a binary event
+class Cursor
+{
+public:
+    explicit Cursor(std::string_view data) : data_(data)
+    {
+    }
+
+    std::size_t remaining() const
+    {
+        return data_.size();
+    }
+
+    std::string_view bytes(std::size_t size)
+    {
+        if (size > data_.size())
+        {
+            throw std::runtime_error("truncated binlog event");
+        }
+        auto result = data_.substr(0, size);
+        data_.remove_prefix(size);
+        return result;
+    }
+
+    uint64_t integer(std::size_t size)
+    {
+        auto field = bytes(size);
+        uint64_t result = 0;
+        for (auto i = size; i-- > 0;)
+        {
+            result = (result << 8) | static_cast<uint8_t>(field[i]);
+        }
+        return result;
+    }
+
+    // length encoded integer
+    uint64_t packed()
+    {
+        auto first = integer(1);
+        switch (first)
+        {
+        case 252:
+            return integer(2);
+        case 253:
+            return integer(3);
+        case 254:
+            return integer(8);
+        default:
+            if (first >= 251)
+            {
+                throw std::runtime_error("invalid length in binlog event");
+            }
+            return first;
+        }
+    }
+
+    int64_t signed_integer(uint8_t type)
+    {
+        auto size = column_size(type);
+        auto shift = 64 - 8 * size;
+        return static_cast<int64_t>(integer(size) << shift) >> shift;
+    }
+
+    // the exact value of a numeric column
+    double number(uint8_t type)
+    {
+        if (type == type_double)
+        {
+            auto bits = integer(8);
+            double result;
+            std::memcpy(&result, &bits, sizeof(result));
+            return result;
+        }
+        if (type == type_float)
+        {
+            auto bits = static_cast<uint32_t>(integer(4));
+            float result;
+            std::memcpy(&result, &bits, sizeof(result));
+            return result;
+        }
+        return static_cast<double>(signed_integer(type));
+    }
+
+private:
+    std::string_view data_;
+};
+
+// mysqlbinlog running as child process, its stdout is read line by line
+class Child
+{
+public:
+    Child(const std::vector<std::string>& args, const std::string& password)
+    {
+        int fds[2];
+        if (::pipe2(fds, O_CLOEXEC) < 0)
+        {
+            throw std::system_error(errno, std::system_category(), "pipe");
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+
+        // keep the password off the command line
+        std::vector<std::string> env;
+        for (char** e = environ; *e; e++)
+        {
+            env.emplace_back(*e);
+        }
+        if (!password.empty())
+        {
+            env.push_back("MYSQL_PWD=" + password);
+        }
+        std::vector<char*> envp, argv;
+        for (auto& e : env)
+        {
+            envp.push_back(e.data());
+        }
+        envp.push_back(nullptr);
+        std::vector<std::string> args_copy(args);
+        for (auto& a : args_copy)
+        {
+            argv.push_back(a.data());
+        }
+        argv.push_back(nullptr);
+
+        auto ret = posix_spawnp(&pid_, argv[0], &actions, nullptr, argv.data(), envp.data());
+        posix_spawn_file_actions_destroy(&actions);
+        ::close(fds[1]);
+        if (ret != 0)
+        {
+            ::close(fds[0]);
+            throw std::system_error(ret, std::system_category(), "spawn " + args[0]);
+        }
+        fd_ = fds[0];
+    }
+
+    ~Child()
+    {
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
+        if (pid_ > 0)
+        {
+            ::kill(pid_, SIGTERM);
+            wait();
+        }
+    }
+
+    // returns false on timeout, nothing at the end of the output
+    std::optional<bool> read_line(std::string& line, int timeout_ms)
+    {
+        while (true)
+        {
+            auto newline = buffer_.find('\n');
+            if (newline != std::string::npos)
+            {
+                line.assign(buffer_, 0, newline);
+                buffer_.erase(0, newline + 1);
+                return true;
+            }
+            if (eof_)
+            {
+                return std::nullopt;
+            }
+
+            pollfd pfd = { fd_, POLLIN, 0 };
+            auto ready = ::poll(&pfd, 1, timeout_ms);
+            if (ready == 0 || (ready < 0 && errno == EINTR))
+            {
+                return false;
+            }
+            char chunk[65536];
+            auto size = ::read(fd_, chunk, sizeof(chunk));
+            if (size < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (size <= 0)
+            {
+                eof_ = true;
+                continue;
+            }
+            buffer_.append(chunk, size);
+        }
+    }
+
+    int wait()
+    {
+        int status = 0;
+        while (::waitpid(pid_, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+        pid_ = -1;
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+private:
+    pid_t pid_ = -1;
+    int fd_ = -1;
+    std::string buffer_;
+    bool eof_ = false;
+};
+
+struct target
+{
+    std::string metric_name;
+    // last is only known once the metric has been opened
+    bool opened = false;
+    hta::TimePoint last;
+};
+
+void write_state(const std::string& state_file, const std::string& file, uint64_t position)
+{
+    // write and rename, so that a crash never leaves a partial state behind
+    auto tmp_file = state_file + ".tmp";
+    {
+        std::ofstream state(tmp_file);
+        state << nlohmann::json{ { "file", file }, { "position", position } }.dump() << std::endl;
+        if (!state)
+        {
+            throw std::runtime_error("failed to write binlog state " + tmp_file);
+        }
+    }
+    std::filesystem::rename(tmp_file, state_file);
+}
+} // namespace
+
+void Parser::feed(std::string_view line)
+{
+    if (in_binlog_)
+    {
+        // the statement ends with the closing quote, usually on a line of its own
+        auto quote = line.find('\'');
+        base64_.append(line.substr(0, quote));
+        if (quote != std::string_view::npos)
+        {
+            in_binlog_ = false;
+            decode_events(base64_decode(base64_));
+            base64_.clear();
+        }
+        return;
+    }
+    if (starts_with(line, "BINLOG '"))
+    {
+        in_binlog_ = true;
+        feed(line.substr(8));
+        return;
+    }
+
+    if (starts_with(line, "#") && line.find("end_log_pos ") != std::string_view::npos)
+    {
+        end_position_ = number_after(line, "end_log_pos ");
+        checksum_ = line.find(" CRC32 0x") != std::string_view::npos;
+        if (auto pos = line.find("Rotate to "); pos != std::string_view::npos)
+        {
+            auto rest = line.substr(pos + 10);
+            file_ = rest.substr(0, rest.find_first_of(" \t"));
+            committed_position_ = number_after(rest, "pos: ");
+        }
+    }
+    else if (starts_with(line, "COMMIT"))
+    {
+        committed_position_ = end_position_;
+    }
+}
+
+void Parser::decode_events(const std::string& data)
+{
+    Cursor events(data);
+    while (events.remaining() > 0)
+    {
+        Cursor header(events.bytes(event_header_size));
+        header.integer(4);
+        auto type = static_cast<uint8_t>(header.integer(1));
+        header.integer(4);
+        auto size = header.integer(4);
+        auto trailer = checksum_ ? checksum_size : 0;
+        if (size < event_header_size + trailer)
+        {
+            throw std::runtime_error("invalid binlog event size " + std::to_string(size));
+        }
+        auto body = events.bytes(size - event_header_size);
+        body.remove_suffix(trailer);
+
+        switch (type)
+        {
+        case table_map_event:
+            decode_table_map(body);
+            break;
+        case write_rows_v1:
+        case update_rows_v1:
+        case delete_rows_v1:
+        case write_rows_v2:
+        case update_rows_v2:
+        case delete_rows_v2:
+            decode_rows(body, type);
+            break;
+        default:
+            // e.g. the format description, which the BINLOG statements start with
+            break;
+        }
+    }
+}
+
+void Parser::decode_table_map(std::string_view body)
+{
+    Cursor event(body);
+    auto id = event.integer(6);
+    event.integer(2);
+    std::string schema(event.bytes(event.integer(1)));
+    event.bytes(1);
+    std::string table(event.bytes(event.integer(1)));
+    event.bytes(1);
+    auto types = event.bytes(event.packed());
+
+    table_map map{ schema, table, !accept_ || accept_(schema, table),
+                   std::vector<uint8_t>(types.begin(), types.end()) };
+    if (map.accepted)
+    {
+        bool supported = map.types.size() >= 2;
+        for (auto type : map.types)
+        {
+            supported = supported && column_size(type) > 0;
+        }
+        if (!supported)
+        {
+            throw std::runtime_error("cannot decode the rows of `" + schema + "`.`" + table +
+                                     "`, only integer and floating point columns are supported");
+        }
+    }
+    tables_[id] = std::move(map);
+}
+
+void Parser::decode_rows(std::string_view body, uint8_t type)
+{
+    Cursor event(body);
+    auto id = event.integer(6);
+    event.integer(2);
+    if (type >= write_rows_v2)
+    {
+        // the length includes its own two bytes
+        auto extra = event.integer(2);
+        event.bytes(std::max<uint64_t>(extra, 2) - 2);
+    }
+    auto it = tables_.find(id);
+    if (it == tables_.end() || !it->second.accepted)
+    {
+        return;
+    }
+    const auto& types = it->second.types;
+
+    auto columns = event.packed();
+    if (columns != types.size())
+    {
+        throw std::runtime_error("rows event does not match the table map of " +
+                                 it->second.table);
+    }
+    bool update = type == update_rows_v1 || type == update_rows_v2;
+    auto before = event.bytes((columns + 7) / 8);
+    auto after = update ? event.bytes((columns + 7) / 8) : before;
+
+    // a row image has the columns of the bitmap that are not null, in column order
+    auto image = [&event, &types, columns](std::string_view bitmap) {
+        std::size_t present = 0;
+        for (std::size_t column = 0; column < columns; column++)
+        {
+            present += bit(bitmap, column);
+        }
+        auto nulls = event.bytes((present + 7) / 8);
+        std::optional<int64_t> timestamp;
+        std::optional<double> value;
+        for (std::size_t column = 0, index = 0; column < columns; column++)
+        {
+            if (!bit(bitmap, column) || bit(nulls, index++))
+            {
+                continue;
+            }
+            auto column_type = types[column];
+            if (column == 0)
+            {
+                timestamp = column_type == type_double || column_type == type_float ?
+                                static_cast<int64_t>(event.number(column_type)) :
+                                event.signed_integer(column_type);
+            }
+            else if (column == 1)
+            {
+                value = event.number(column_type);
+            }
+            else
+            {
+                event.bytes(column_size(column_type));
+            }
+        }
+        return std::make_pair(timestamp, value);
+    };
+
+    while (event.remaining() > 0)
+    {
+        auto [timestamp, value] = image(before);
+        if (update)
+        {
+            image(after);
+        }
+        if (type == write_rows_v1 || type == write_rows_v2)
+        {
+            if (timestamp && value)
+            {
+                on_row_(it->second.schema, it->second.table, *timestamp, *value);
+            }
+        }
+        else
+        {
+            ignored_rows_++;
+        }
+    }
+}
+
+void follow(nlohmann::json config, const options& options, Status& status)
+{
+    const auto& conf_import = config["import"];
+    std::string schema = conf_import["database"];
+
+    std::map<std::string, target> targets;
+    for (const auto& metric_config : config["metrics"])
+    {
+        std::string name = metric_config["name"];
+        std::string table = name;
+        std::replace(table.begin(), table.end(), '.', '_');
+        table = metric_config.value("import_name", table);
+        targets[table].metric_name = name;
+    }
+
+    // metrics are only opened once the binlog has a row for them
+    MetricCache metric_cache(config, options.max_open_metrics);
+
+    std::string start_file = options.start_file;
+    uint64_t start_position = options.start_position;
+    if (!options.state_file.empty() && std::filesystem::exists(options.state_file))
+    {
+        std::ifstream state_stream(options.state_file);
+        auto state = nlohmann::json::parse(state_stream);
+        start_file = state["file"];
+        start_position = state["position"];
+    }
+
+    // the rows are decoded from the binary events, not from the lossy pseudo SQL of --verbose
+    std::vector<std::string> args = { options.mysqlbinlog, "--base64-output=AUTO" };
+    std::string password;
+    if (options.files.empty())
+    {
+        if (start_file.empty())
+        {
+            throw std::runtime_error("following the server requires a binlog start file");
+        }
+        args.push_back("--read-from-remote-server");
+        args.push_back("--stop-never");
+        args.push_back("--host=" + conf_import["host"].get<std::string>());
+        args.push_back("--user=" + conf_import["user"].get<std::string>());
+        args.push_back("--start-position=" + std::to_string(start_position));
+        args.push_back(start_file);
+        password = conf_import["password"];
+    }
+    else
+    {
+        args.insert(args.end(), options.files.begin(), options.files.end());
+    }
+
+    uint64_t rows = 0;
+    uint64_t skipped = 0;
+    auto accept = [&schema, &targets](const std::string& row_schema, const std::string& table) {
+        return row_schema == schema && targets.count(table) > 0;
+    };
+    auto on_row = [&](const std::string&, const std::string& table, int64_t timestamp,
+                      double value) {
+        auto& t = targets.at(table);
+        auto& metric = metric_cache.get(t.metric_name);
+        if (!t.opened)
+        {
+            // replayed rows that are already in the metric must be skipped
+            t.last = metric.range().second;
+            t.opened = true;
+        }
+        hta::TimePoint time{ hta::duration_cast(std::chrono::milliseconds(timestamp)) };
+        if (time <= t.last)
+        {
+            skipped++;
+            return;
+        }
+        metric.insert({ time, value });
+        t.last = time;
+        rows++;
+        status.row(timestamp);
+    };
+    Parser parser(on_row, accept);
+
+    auto checkpoint = [&]() {
+        status.set_phase("flush");
+        metric_cache.flush();
+        if (!options.state_file.empty() && !parser.file().empty())
+        {
+            write_state(options.state_file, parser.file(), parser.committed_position());
+        }
+        status.set_phase("follow");
+    };
+
+    status.set_metric("binlog", options.files.empty() ? start_file : options.files.front());
+    status.set_phase("follow");
+    std::cout << "[binlog] following " << targets.size() << " tables of " << schema << std::endl;
+
+    Child child(args, password);
+    using clock = std::chrono::steady_clock;
+    auto interval = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(options.flush_interval));
+    auto next_checkpoint = clock::now() + interval;
+    std::string line;
+    while (true)
+    {
+        auto result = child.read_line(line, 200);
+        if (!result)
+        {
+            break;
+        }
+        if (*result)
+        {
+            parser.feed(line);
+        }
+        if (clock::now() >= next_checkpoint)
+        {
+            checkpoint();
+            next_checkpoint = clock::now() + interval;
+        }
+        if (options.stop_requested && *options.stop_requested)
+        {
+            break;
+        }
+    }
+    checkpoint();
+
+    std::cout << "[binlog] applied " << rows << " rows, skipped " << skipped
+              << " already imported rows and " << parser.ignored_rows()
+              << " updates / deletes" << std::endl;
+
+    if (!(options.stop_requested && *options.stop_requested))
+    {
+        if (auto exit_code = child.wait(); exit_code != 0)
+        {
+            throw std::runtime_error("mysqlbinlog failed with exit code " +
+                                     std::to_string(exit_code));
+        }
+    }
+}
+} // namespace binlog
@@ -0,0 +1,134 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "status.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdint>
+
+// Continuous sync from the row-based binlog of the dataheap server. The binlog is read by
+// mysqlbinlog, so the sync cost only depends on the write rate, not on the number of tables.
+namespace binlog
+{
+// Parses the output of mysqlbinlog --base64-output=AUTO line by line and passes the rows of
+// write rows events to the callback. The rows are decoded from the binary events in the BINLOG
+// statements, the pseudo SQL of --verbose prints doubles with only 6 significant digits.
+// Dataheap tables have the columns (timestamp, value).
+class Parser
+{
+public:
+    using callback = std::function<void(const std::string& schema, const std::string& table,
+                                        int64_t timestamp, double value)>;
+    // whether the rows of a table are decoded at all
+    using filter = std::function<bool(const std::string& schema, const std::string& table)>;
+
+    explicit Parser(callback on_row, filter accept = {})
+    : on_row_(std::move(on_row)), accept_(std::move(accept))
+    {
+    }
+
+    void feed(std::string_view line);
+
+    // binlog file and position after the last committed transaction, to resume from
+    const std::string& file() const
+    {
+        return file_;
+    }
+
+    uint64_t committed_position() const
+    {
+        return committed_position_;
+    }
+
+    // UPDATE / DELETE rows, which are not applied
+    uint64_t ignored_rows() const
+    {
+        return ignored_rows_;
+    }
+
+private:
+    struct table_map
+    {
+        std::string schema;
+        std::string table;
+        // rows of tables that are not accepted are skipped without decoding
+        bool accepted;
+        std::vector<uint8_t> types;
+    };
+
+    void decode_events(const std::string& data);
+    void decode_table_map(std::string_view body);
+    void decode_rows(std::string_view body, uint8_t type);
+
+    callback on_row_;
+    filter accept_;
+    std::string file_;
+    uint64_t end_position_ = 0;
+    uint64_t committed_position_ = 0;
+    uint64_t ignored_rows_ = 0;
+
+    // whether the events carry a CRC32 checksum, as printed in their header comments
+    bool checksum_ = false;
+    bool in_binlog_ = false;
+    std::string base64_;
+    std::map<uint64_t, table_map> tables_;
+};
+
+struct options
+{
+    // read these binlog files and exit, otherwise follow the server of the import config
+    std::vector<std::string> files;
+    // binlog file and position to start following the server, if there is no state yet
+    std::string start_file;
+    uint64_t start_position = 4;
+    // JSON file with the position of the last checkpoint, to resume from
+    std::string state_file;
+    std::string mysqlbinlog = "mysqlbinlog";
+    // seconds between flushes / checkpoints
+    double flush_interval = 1;
+    // metrics open at a time, 0 for the limit given by the file descriptors
+    std::size_t max_open_metrics = 0;
+    const std::atomic<bool>* stop_requested = nullptr;
+};
+
+// Appends all inserts on tables of the configured metrics to the metrics in the hta::Directory.
+// Metrics can set "import_name", otherwise the table is the metric name with '.' replaced by '_'.
+void follow(nlohmann::json config, const options& options, Status& status);
+} // namespace binlog
@@ -0,0 +1,555 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "dump.hpp"
+#include "uring.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+
+#include <cstdlib>
+
+#include <zlib.h>
+
+#ifdef HTA_IMPORT_ZSTD
+#include <zstd.h>
+#endif
+
+namespace dump
+{
+namespace
+{
+constexpr std::size_t read_block_size = 1 << 20;
+constexpr std::size_t output_block_size = 1 << 20;
+
+nlohmann::json read_json(const std::filesystem::path& path)
+{
+    std::ifstream file;
+    file.exceptions(std::ios::badbit | std::ios::failbit);
+    file.open(path);
+    nlohmann::json json;
+    file >> json;
+    return json;
+}
+
+char terminator(const nlohmann::json& options, const char* key, char fallback)
+{
+    if (!options.count(key))
+    {
+        return fallback;
+    }
+    std::string value = options[key];
+    if (value.size() != 1)
+    {
+        throw std::runtime_error(std::string("unsupported dump option ") + key + ": " + value);
+    }
+    return value[0];
+}
+
+// Splits the decompressed data into lines, a line may span blocks
+class LineParser
+{
+public:
+    LineParser(const table& table, uint64_t min_timestamp, uint64_t max_timestamp,
+               std::vector<row>& rows)
+    : table_(table), min_timestamp_(min_timestamp), max_timestamp_(max_timestamp), rows_(rows)
+    {
+    }
+
+    void feed(std::string_view data)
+    {
+        if (!partial_.empty())
+        {
+            auto end = data.find(table_.line_terminator);
+            if (end == std::string_view::npos)
+            {
+                partial_.append(data);
+                return;
+            }
+            partial_.append(data.substr(0, end));
+            line(partial_);
+            partial_.clear();
+            data.remove_prefix(end + 1);
+        }
+        while (true)
+        {
+            auto end = data.find(table_.line_terminator);
+            if (end == std::string_view::npos)
+            {
+                partial_.assign(data);
+                return;
+            }
+            line(data.substr(0, end));
+            data.remove_prefix(end + 1);
+        }
+    }
+
+    void finish()
+    {
+        if (!partial_.empty())
+        {
+            line(partial_);
+            partial_.clear();
+        }
+    }
+
+private:
+    void line(std::string_view line)
+    {
+        std::string_view timestamp;
+        std::string_view value;
+        std::size_t column = 0;
+        while (true)
+        {
+            auto end = line.find(table_.field_terminator);
+            auto field = line.substr(0, end);
+            if (column == table_.timestamp_column)
+            {
+                timestamp = field;
+            }
+            if (column == table_.value_column)
+            {
+                value = field;
+            }
+            if (end == std::string_view::npos)
+            {
+                break;
+            }
+            line.remove_prefix(end + 1);
+            column++;
+        }
+        if (timestamp.empty() || value.empty() || value == "\\N")
+        {
+            // NULL or missing, there is nothing to import
+            return;
+        }
+
+        uint64_t t;
+        auto parsed = std::from_chars(timestamp.data(), timestamp.data() + timestamp.size(), t);
+        if (parsed.ec != std::errc() || parsed.ptr != timestamp.data() + timestamp.size())
+        {
+            throw std::runtime_error("invalid timestamp in dump: " + std::string(timestamp));
+        }
+        if (t < min_timestamp_ || (max_timestamp_ && t >= max_timestamp_))
+        {
+            return;
+        }
+        // the value is followed by a terminator or, in partial_, by the null character
+        char* end;
+        double v = std::strtod(value.data(), &end);
+        if (end != value.data() + value.size())
+        {
+            throw std::runtime_error("invalid value in dump: " + std::string(value));
+        }
+        rows_.push_back({ t, v });
+    }
+
+    const table& table_;
+    uint64_t min_timestamp_;
+    uint64_t max_timestamp_;
+    std::vector<row>& rows_;
+    std::string partial_;
+};
+
+template <typename Consumer>
+void gunzip(uring::FileReader& file, Consumer&& consume)
+{
+    z_stream stream{};
+    // 16: gzip header
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+    {
+        throw std::runtime_error("inflateInit2 failed");
+    }
+    struct end_inflate
+    {
+        z_stream& stream;
+        ~end_inflate()
+        {
+            inflateEnd(&stream);
+        }
+    } end_inflate_guard{ stream };
+
+    std::vector<char> output(output_block_size);
+    bool end_of_stream = false;
+    for (auto block = file.next(); !block.empty(); block = file.next())
+    {
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(block.data()));
+        stream.avail_in = static_cast<uInt>(block.size());
+        while (stream.avail_in > 0)
+        {
+            if (end_of_stream)
+            {
+                // concatenated gzip members
+                inflateReset(&stream);
+                end_of_stream = false;
+            }
+            stream.next_out = reinterpret_cast<Bytef*>(output.data());
+            stream.avail_out = static_cast<uInt>(output.size());
+            auto result = inflate(&stream, Z_NO_FLUSH);
+            if (result != Z_OK && result != Z_STREAM_END)
+            {
+                throw std::runtime_error(std::string("gzip: ") +
+                                         (stream.msg ? stream.msg : "inflate failed"));
+            }
+            consume(std::string_view(output.data(), output.size() - stream.avail_out));
+            end_of_stream = result == Z_STREAM_END;
+        }
+    }
+    if (!end_of_stream)
+    {
+        throw std::runtime_error("gzip: truncated file");
+    }
+}
+
+#ifdef HTA_IMPORT_ZSTD
+template <typename Consumer>
+void unzstd(uring::FileReader& file, Consumer&& consume)
+{
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(),
+                                                                 &ZSTD_freeDCtx);
+    std::vector<char> output(output_block_size);
+    std::size_t remaining = 0;
+    for (auto block = file.next(); !block.empty(); block = file.next())
+    {
+        ZSTD_inBuffer in{ block.data(), block.size(), 0 };
+        while (in.pos < in.size)
+        {
+            ZSTD_outBuffer out{ output.data(), output.size(), 0 };
+            remaining = ZSTD_decompressStream(context.get(), &out, &in);
+            if (ZSTD_isError(remaining))
+            {
+                throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(remaining));
+            }
+            consume(std::string_view(output.data(), out.pos));
+        }
+    }
+    // flush the rest of the last frame
+    while (remaining != 0)
+    {
+        ZSTD_inBuffer in{ nullptr, 0, 0 };
+        ZSTD_outBuffer out{ output.data(), output.size(), 0 };
+        remaining = ZSTD_decompressStream(context.get(), &out, &in);
+        if (ZSTD_isError(remaining) || out.pos == 0)
+        {
+            throw std::runtime_error("zstd: truncated file");
+        }
+        consume(std::string_view(output.data(), out.pos));
+    }
+}
+#endif
+} // namespace
+
+table find_table(const std::filesystem::path& directory, const std::string& schema,
+                 const std::string& name)
+{
+    if (!std::filesystem::exists(directory / "@.done.json"))
+    {
+        throw std::runtime_error("dump in " + directory.string() + " is incomplete");
+    }
+
+    // the file names of the metadata encode special characters, so compare the contents
+    std::optional<std::string> prefix;
+    nlohmann::json metadata;
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+    {
+        auto filename = entry.path().filename().string();
+        if (entry.path().extension() != ".json" || filename[0] == '@' ||
+            filename.find('@') == std::string::npos)
+        {
+            continue;
+        }
+        auto json = read_json(entry.path());
+        if (!json.count("options"))
+        {
+            continue;
+        }
+        const auto& options = json["options"];
+        if (options.value("table", "") != name ||
+            (!schema.empty() && options.value("schema", "") != schema))
+        {
+            continue;
+        }
+        if (prefix)
+        {
+            throw std::runtime_error("table " + name + " is in several schemas of the dump");
+        }
+        prefix = entry.path().stem().string();
+        metadata = std::move(json);
+    }
+    if (!prefix)
+    {
+        throw std::runtime_error("table " + name + " is not in the dump");
+    }
+
+    const auto& options = metadata["options"];
+    table t;
+    t.schema = options.value("schema", "");
+    t.name = name;
+    std::string extension = metadata.value("extension", "tsv");
+    t.compression = metadata.value("compression", "none");
+    if (!metadata.count("compression"))
+    {
+        if (extension.size() > 4 && extension.substr(extension.size() - 4) == ".zst")
+        {
+            t.compression = "zstd";
+        }
+        else if (extension.size() > 3 && extension.substr(extension.size() - 3) == ".gz")
+        {
+            t.compression = "gzip";
+        }
+    }
+    if (t.compression != "none" && t.compression != "gzip" && t.compression != "zstd")
+    {
+        throw std::runtime_error("unsupported compression of the dump: " + t.compression);
+    }
+#ifndef HTA_IMPORT_ZSTD
+    if (t.compression == "zstd")
+    {
+        throw std::runtime_error("zstd compressed dumps require a build with -DHTA_IMPORT_ZSTD=ON");
+    }
+#endif
+    t.field_terminator = terminator(options, "fieldsTerminatedBy", '\t');
+    t.line_terminator = terminator(options, "linesTerminatedBy", '\n');
+    if (options.count("columns"))
+    {
+        std::vector<std::string> columns = options["columns"];
+        auto index = [&columns, &name](const std::string& column) {
+            auto it = std::find(columns.begin(), columns.end(), column);
+            if (it == columns.end())
+            {
+                throw std::runtime_error("table " + name + " has no column " + column);
+            }
+            return static_cast<std::size_t>(it - columns.begin());
+        };
+        t.timestamp_column = index("timestamp");
+        t.value_column = index("value");
+    }
+
+    // "schema@table.tsv.zst" if not chunked, otherwise "schema@table@N.tsv.zst" with the last
+    // chunk named "schema@table@@N.tsv.zst"
+    std::vector<std::pair<uint64_t, std::filesystem::path>> chunks;
+    auto suffix = "." + extension;
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+    {
+        auto filename = entry.path().filename().string();
+        if (filename.size() <= prefix->size() + suffix.size() ||
+            filename.compare(0, prefix->size(), *prefix) != 0 ||
+            filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) != 0)
+        {
+            continue;
+        }
+        auto middle = filename.substr(prefix->size(),
+                                      filename.size() - prefix->size() - suffix.size());
+        if (middle.empty())
+        {
+            chunks.emplace_back(0, entry.path());
+            continue;
+        }
+        auto digits = middle.find_first_not_of('@');
+        if (digits == 0 || digits > 2 || digits == std::string::npos)
+        {
+            continue;
+        }
+        uint64_t number;
+        auto end = middle.data() + middle.size();
+        auto parsed = std::from_chars(middle.data() + digits, end, number);
+        if (parsed.ec != std::errc() || parsed.ptr != end)
+        {
+            continue;
+        }
+        chunks.emplace_back(number, entry.path());
+    }
+    std::sort(chunks.begin(), chunks.end());
+    for (auto& chunk : chunks)
+    {
+        t.chunks.push_back(std::move(chunk.second));
+    }
+    return t;
+}
+
+Reader::Reader(table table, std::size_t threads, uint64_t min_timestamp, uint64_t max_timestamp,
+               bool drop_cache)
+: table_(std::move(table)), min_timestamp_(min_timestamp), max_timestamp_(max_timestamp),
+  drop_cache_(drop_cache)
+{
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, std::max<std::size_t>(table_.chunks.size(), 1));
+    window_ = 2 * threads;
+    for (std::size_t i = 0; i < threads; i++)
+    {
+        threads_.emplace_back([this]() { run(); });
+    }
+}
+
+Reader::~Reader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    taken_.notify_all();
+    for (auto& thread : threads_)
+    {
+        thread.join();
+    }
+}
+
+void Reader::run()
+{
+    while (true)
+    {
+        std::size_t index;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            taken_.wait(lock, [this]() {
+                return stop_ || next_decode_ >= table_.chunks.size() ||
+                       next_decode_ < next_take_ + window_;
+            });
+            if (stop_ || next_decode_ >= table_.chunks.size())
+            {
+                return;
+            }
+            index = next_decode_++;
+        }
+        chunk c;
+        try
+        {
+            c.rows = decode(table_.chunks[index]);
+        }
+        catch (...)
+        {
+            c.error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_.emplace(index, std::move(c));
+        }
+        decoded_.notify_all();
+    }
+}
+
+std::vector<row> Reader::decode(const std::filesystem::path& path)
+{
+    std::vector<row> rows;
+    LineParser parser(table_, min_timestamp_, max_timestamp_, rows);
+    auto consume = [&parser](std::string_view data) { parser.feed(data); };
+
+    uring::FileReader file(path, read_block_size, 4, drop_cache_);
+    if (table_.compression == "gzip")
+    {
+        gunzip(file, consume);
+    }
+#ifdef HTA_IMPORT_ZSTD
+    else if (table_.compression == "zstd")
+    {
+        unzstd(file, consume);
+    }
+#endif
+    else
+    {
+        for (auto block = file.next(); !block.empty(); block = file.next())
+        {
+            consume(block);
+        }
+    }
+    parser.finish();
+    compressed_bytes_ += file.size();
+
+    auto earlier = [](const row& a, const row& b) { return a.timestamp < b.timestamp; };
+    if (!std::is_sorted(rows.begin(), rows.end(), earlier))
+    {
+        std::stable_sort(rows.begin(), rows.end(), earlier);
+    }
+    return rows;
+}
+
+std::vector<row> Reader::take()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto index = next_take_;
+    decoded_.wait(lock, [this, index]() { return done_.count(index) > 0; });
+    auto node = done_.extract(index);
+    next_take_++;
+    lock.unlock();
+    taken_.notify_all();
+
+    if (node.mapped().error)
+    {
+        std::rethrow_exception(node.mapped().error);
+    }
+    return std::move(node.mapped().rows);
+}
+
+std::vector<row> Reader::next()
+{
+    std::vector<row> rows;
+    if (pending_)
+    {
+        rows = std::move(*pending_);
+        pending_.reset();
+    }
+    while (rows.empty() && next_take_ < table_.chunks.size())
+    {
+        rows = take();
+    }
+
+    // usually the following chunk starts after this one, so it is returned as it is
+    while (!rows.empty() && next_take_ < table_.chunks.size())
+    {
+        auto following = take();
+        if (following.empty())
+        {
+            continue;
+        }
+        if (following.front().timestamp > rows.back().timestamp)
+        {
+            pending_ = std::move(following);
+            break;
+        }
+        std::vector<row> merged;
+        merged.reserve(rows.size() + following.size());
+        std::merge(rows.begin(), rows.end(), following.begin(), following.end(),
+                   std::back_inserter(merged),
+                   [](const row& a, const row& b) { return a.timestamp < b.timestamp; });
+        rows = std::move(merged);
+        merged_chunks_++;
+    }
+    return rows;
+}
+} // namespace dump
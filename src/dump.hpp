@@ -0,0 +1,145 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+// Source for dump sets in the format of MySQL Shell (util.dumpInstance, dumpSchemas, dumpTables):
+// a directory with JSON metadata and the rows of each table as TSV, split into many chunk files
+// that are usually compressed with zstd or gzip.
+namespace dump
+{
+struct row
+{
+    uint64_t timestamp;
+    double value;
+};
+
+struct table
+{
+    std::string schema;
+    std::string name;
+    // "none", "gzip" or "zstd"
+    std::string compression;
+    // data files in chunk order
+    std::vector<std::filesystem::path> chunks;
+    std::size_t timestamp_column = 0;
+    std::size_t value_column = 1;
+    char field_terminator = '\t';
+    char line_terminator = '\n';
+};
+
+// Finds a table in the dump set by its metadata, schema may be empty if the name is unique.
+// Throws if the dump is incomplete.
+table find_table(const std::filesystem::path& directory, const std::string& schema,
+                 const std::string& name);
+
+// Decompresses and parses the chunk files of a table on a pool of threads, a bounded number of
+// chunks ahead of the consumer. Mysqlsh chunks cover ascending key ranges, so the chunks are
+// returned in order. Neighbouring chunks whose ranges overlap are merged, so the rows are
+// returned in timestamp order.
+class Reader
+{
+public:
+    // rows outside of [min_timestamp, max_timestamp) are skipped, max_timestamp 0 for no limit
+    Reader(table table, std::size_t threads, uint64_t min_timestamp, uint64_t max_timestamp,
+           bool drop_cache = false);
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // next rows in timestamp order, empty at the end, rethrows errors of the decoding threads
+    std::vector<row> next();
+
+    std::size_t chunks() const
+    {
+        return table_.chunks.size();
+    }
+
+    // chunks merged with their predecessor because their ranges overlapped
+    std::size_t merged_chunks() const
+    {
+        return merged_chunks_;
+    }
+
+    // bytes of the compressed files read so far
+    uint64_t compressed_bytes() const
+    {
+        return compressed_bytes_;
+    }
+
+private:
+    struct chunk
+    {
+        std::vector<row> rows;
+        std::exception_ptr error;
+    };
+
+    void run();
+    std::vector<row> decode(const std::filesystem::path& path);
+    // waits until the next chunk in order is decoded and takes it
+    std::vector<row> take();
+
+    table table_;
+    uint64_t min_timestamp_;
+    uint64_t max_timestamp_;
+    bool drop_cache_;
+    // decoded chunks that may wait for the consumer
+    std::size_t window_;
+
+    std::mutex mutex_;
+    std::condition_variable decoded_;
+    std::condition_variable taken_;
+    std::map<std::size_t, chunk> done_;
+    // next chunk to decode and next chunk to take
+    std::size_t next_decode_ = 0;
+    std::size_t next_take_ = 0;
+    bool stop_ = false;
+
+    // a chunk that was taken to check for an overlap, but not merged
+    std::optional<std::vector<row>> pending_;
+    std::size_t merged_chunks_ = 0;
+    std::atomic<uint64_t> compressed_bytes_{ 0 };
+    std::vector<std::thread> threads_;
+};
+} // namespace dump
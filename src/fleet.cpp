@@ -0,0 +1,353 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "fleet.hpp"
+
+#include <cppconn/resultset.h>
+#include <cppconn/statement.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+namespace fleet
+{
+namespace
+{
+template <typename T>
+clock::duration seconds(T s)
+{
+    return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(s));
+}
+} // namespace
+
+Scheduler::Scheduler(sql::Connection& db, nlohmann::json config, const options& options,
+                     Status& status)
+: db_(db), options_(options), status_(status), metric_cache_(config, options.max_open_metrics)
+{
+    auto now = clock::now();
+    for (const auto& metric_config : config["metrics"])
+    {
+        table t;
+        t.metric_name = metric_config["name"];
+        t.name = t.metric_name;
+        std::replace(t.name.begin(), t.name.end(), '.', '_');
+        t.name = metric_config.value("import_name", t.name);
+        t.interval = seconds(options_.min_interval);
+        t.next_poll = now;
+        t.last_poll = now;
+        tables_.push_back(std::move(t));
+    }
+}
+
+void Scheduler::run()
+{
+    std::cout << "[sync] polling " << tables_.size() << " tables" << std::endl;
+    status_.set_metric("sync", "");
+    auto budget = seconds(1. / options_.queries_per_second);
+    while (!(options_.stop_requested && *options_.stop_requested))
+    {
+        auto begin = clock::now();
+        auto queries = poll_due();
+        if (queries == 0)
+        {
+            // nothing due, sleep until the next table is, but stay responsive to stop requests
+            auto next = std::min_element(tables_.begin(), tables_.end(),
+                                         [](const auto& a, const auto& b) {
+                                             return a.next_poll < b.next_poll;
+                                         });
+            auto wait = next == tables_.end() ? seconds(1) : next->next_poll - clock::now();
+            std::this_thread::sleep_for(std::clamp(wait, clock::duration::zero(), seconds(1)));
+            continue;
+        }
+        // keep the query rate bounded
+        std::this_thread::sleep_until(begin + budget * queries);
+    }
+    std::cout << "[sync] " << rows_ << " rows in " << queries_ << " queries, skipped " << skipped_
+              << " duplicate or out of order rows and " << extreme_ << " extreme values"
+              << std::endl;
+}
+
+std::size_t Scheduler::poll_due()
+{
+    auto now = clock::now();
+    std::vector<table*> due;
+    for (auto& t : tables_)
+    {
+        if (t.next_poll <= now)
+        {
+            due.push_back(&t);
+        }
+    }
+    if (due.empty())
+    {
+        return 0;
+    }
+    // most overdue first, the rest waits for the next round if the budget is exhausted
+    std::sort(due.begin(), due.end(),
+              [](const table* a, const table* b) { return a->next_poll < b->next_poll; });
+    auto max_tables = std::max<std::size_t>(
+        1, options_.tables_per_query * std::max<std::size_t>(1, options_.queries_per_second));
+    due.resize(std::min(due.size(), max_tables));
+
+    // quarantined tables must not fail the query of the others
+    std::size_t queries = 0;
+    auto healthy = std::stable_partition(due.begin(), due.end(),
+                                         [](const table* t) { return !t->quarantined; });
+    for (auto it = healthy; it != due.end(); ++it)
+    {
+        queries += poll_isolated({ *it });
+    }
+    due.erase(healthy, due.end());
+    for (std::size_t begin = 0; begin < due.size(); begin += options_.tables_per_query)
+    {
+        auto end = std::min(due.size(), begin + options_.tables_per_query);
+        queries += poll_isolated({ due.begin() + begin, due.begin() + end });
+    }
+    return queries;
+}
+
+std::size_t Scheduler::poll_isolated(const std::vector<table*>& tables)
+{
+    std::exception_ptr error;
+    try
+    {
+        poll(tables);
+        return 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "[sync] poll of " << tables.size() << " tables failed: " << e.what()
+                  << std::endl;
+        error = std::current_exception();
+    }
+
+    // find the broken tables, unless the error was not caused by a table at all
+    std::size_t queries = 1;
+    std::vector<table*> failed;
+    bool any_succeeded = false;
+    if (tables.size() == 1)
+    {
+        failed = tables;
+    }
+    else
+    {
+        for (auto t : tables)
+        {
+            queries++;
+            try
+            {
+                poll({ t });
+                any_succeeded = true;
+            }
+            catch (const std::exception& e)
+            {
+                error = std::current_exception();
+                failed.push_back(t);
+                std::cerr << "[" << t->metric_name << "] poll failed: " << e.what() << std::endl;
+            }
+        }
+    }
+    if (failed.empty())
+    {
+        return queries;
+    }
+    if (!any_succeeded)
+    {
+        queries++;
+        if (!connection_alive())
+        {
+            // e.g. the connection was lost, which polling one table at a time does not fix
+            std::rethrow_exception(error);
+        }
+    }
+    // the connection works, so it is the tables that are broken (e.g. dropped or renamed)
+    for (auto t : failed)
+    {
+        t->quarantined = true;
+        t->next_poll = clock::now() + seconds(options_.max_interval);
+        std::cerr << "[" << t->metric_name << "] quarantined table " << t->name << std::endl;
+    }
+    return queries;
+}
+
+bool Scheduler::connection_alive()
+{
+    try
+    {
+        std::unique_ptr<sql::Statement> stmt(db_.createStatement());
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery("SELECT 1"));
+        return res->next();
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+}
+
+void Scheduler::open(table& t)
+{
+    auto& metric = metric_cache_.get(t.metric_name);
+    t.opened = true;
+    try
+    {
+        auto last = metric.range().second.time_since_epoch();
+        t.last = std::chrono::duration_cast<std::chrono::milliseconds>(last).count();
+    }
+    catch (const std::exception&)
+    {
+        // empty metric, sync everything
+        t.last = 0;
+    }
+}
+
+void Scheduler::poll(const std::vector<table*>& tables)
+{
+    for (auto t : tables)
+    {
+        if (!t->opened)
+        {
+            open(*t);
+        }
+    }
+
+    // The index of the table in this poll identifies the rows of each subquery. There is no outer
+    // ORDER BY, which would sort the whole result on the server: each subquery is ordered by its
+    // LIMIT already, the rows are demultiplexed by table here.
+    std::stringstream query;
+    for (std::size_t i = 0; i < tables.size(); i++)
+    {
+        if (i > 0)
+        {
+            query << " UNION ALL ";
+        }
+        query << "(SELECT " << i << " AS t, timestamp, value FROM `" << tables[i]->name
+              << "` WHERE timestamp > " << tables[i]->last << " ORDER BY timestamp LIMIT "
+              << options_.row_limit << ")";
+    }
+
+    status_.set_phase("query");
+    status_.begin_query();
+    std::unique_ptr<sql::ResultSet> res;
+    try
+    {
+        std::unique_ptr<sql::Statement> stmt(db_.createStatement());
+        res.reset(stmt->executeQuery(query.str()));
+    }
+    catch (...)
+    {
+        status_.end_query();
+        throw;
+    }
+    status_.end_query();
+    queries_++;
+
+    status_.set_phase("insert");
+    std::vector<uint64_t> rows(tables.size(), 0);
+    // the subqueries are usually returned one after the other, so the metric is only looked up
+    // when the table changes
+    hta::Metric* metric = nullptr;
+    std::size_t metric_index = tables.size();
+    while (res->next())
+    {
+        auto i = res->getUInt64(1);
+        auto& t = *tables.at(i);
+        if (i != metric_index)
+        {
+            metric = &metric_cache_.get(t.metric_name);
+            metric_index = i;
+        }
+        auto timestamp = res->getInt64(2);
+        auto value = static_cast<double>(res->getDouble(3));
+        // the same checks as the import, a single bad row must not end the sync; the order is
+        // checked per table, as the result is not sorted as a whole
+        if (timestamp <= t.last)
+        {
+            skipped_++;
+            continue;
+        }
+        if (value > 1e12 || value < -1e12)
+        {
+            std::cerr << "[" << t.metric_name << "] skipped extreme value " << value << std::endl;
+            extreme_++;
+            // not polled again
+            t.last = timestamp;
+            continue;
+        }
+        hta::TimePoint time{ hta::duration_cast(std::chrono::milliseconds(timestamp)) };
+        metric->insert({ time, value });
+        t.last = timestamp;
+        rows[i]++;
+        status_.row(timestamp);
+    }
+
+    status_.set_phase("flush");
+    auto now = clock::now();
+    for (std::size_t i = 0; i < tables.size(); i++)
+    {
+        if (rows[i] > 0)
+        {
+            metric_cache_.get(tables[i]->metric_name).flush();
+        }
+        adapt(*tables[i], rows[i], now);
+        tables[i]->quarantined = false;
+        rows_ += rows[i];
+    }
+    status_.set_phase("idle");
+}
+
+void Scheduler::adapt(table& t, uint64_t rows, clock::time_point now)
+{
+    auto elapsed = std::chrono::duration<double>(now - t.last_poll).count();
+    t.last_poll = now;
+    if (rows >= options_.row_limit)
+    {
+        // behind, catch up right away
+        t.next_poll = now;
+        return;
+    }
+    if (elapsed > 0)
+    {
+        constexpr double weight = 0.3;
+        t.rate = weight * (rows / elapsed) + (1 - weight) * t.rate;
+    }
+    auto interval = t.rate > 0 ? options_.target_rows / t.rate : options_.max_interval;
+    if (rows == 0)
+    {
+        // back off quickly from dead tables
+        interval = std::max(interval, 2 * std::chrono::duration<double>(t.interval).count());
+    }
+    interval = std::clamp(interval, options_.min_interval, options_.max_interval);
+    t.interval = seconds(interval);
+    t.next_poll = now + t.interval;
+}
+} // namespace fleet
@@ -0,0 +1,129 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "metric_cache.hpp"
+#include "status.hpp"
+
+#include <hta/hta.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace sql
+{
+class Connection;
+} // namespace sql
+
+// Long-running sync of many metrics by polling "rows newer than T". The polls of many tables are
+// combined into few UNION ALL queries and the poll interval of each table adapts to its write
+// rate, while the number of queries per second stays bounded regardless of the table count.
+namespace fleet
+{
+using clock = std::chrono::steady_clock;
+
+struct options
+{
+    // tables combined into one query
+    std::size_t tables_per_query = 100;
+    // upper bound for the load on the source
+    double queries_per_second = 2;
+    // maximum rows fetched per table and poll, tables that hit it are polled again right away
+    uint64_t row_limit = 100000;
+    // poll interval bounds in seconds
+    double min_interval = 10;
+    double max_interval = 3600;
+    // rows a poll should return on average, the interval is adapted to achieve this
+    double target_rows = 1000;
+    // metrics open at a time, 0 for the limit given by the file descriptors
+    std::size_t max_open_metrics = 0;
+    const std::atomic<bool>* stop_requested = nullptr;
+};
+
+struct table
+{
+    std::string name;
+    std::string metric_name;
+    // last is only known once the metric has been opened
+    bool opened = false;
+    // dataheap timestamp of the last row written
+    int64_t last = 0;
+    clock::time_point next_poll;
+    clock::time_point last_poll;
+    clock::duration interval;
+    // exponentially weighted write rate in rows / s
+    double rate = 0;
+    // the last poll of the table failed although the connection worked, it is polled on its
+    // own until it succeeds again
+    bool quarantined = false;
+};
+
+class Scheduler
+{
+public:
+    Scheduler(sql::Connection& db, nlohmann::json config, const options& options,
+              Status& status);
+
+    // polls until stop is requested
+    void run();
+
+    // one round: polls all due tables within the query budget, returns the number of queries
+    std::size_t poll_due();
+
+private:
+    void open(table& t);
+    // polls the tables in one query, if that fails one query per table, returns the queries
+    // Only tables that fail while the connection works are quarantined, otherwise the error
+    // is rethrown.
+    std::size_t poll_isolated(const std::vector<table*>& tables);
+    // runs a trivial query on the connection
+    bool connection_alive();
+    void poll(const std::vector<table*>& tables);
+    void adapt(table& t, uint64_t rows, clock::time_point now);
+
+    sql::Connection& db_;
+    options options_;
+    Status& status_;
+    MetricCache metric_cache_;
+    std::vector<table> tables_;
+    uint64_t rows_ = 0;
+    // rows at or before the last one of their metric, and values out of range
+    uint64_t skipped_ = 0;
+    uint64_t extreme_ = 0;
+    uint64_t queries_ = 0;
+};
+} // namespace fleet
@@ -0,0 +1,132 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "footprint.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include <cstdlib>
+#include <cstring>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace footprint
+{
+io_counters io_counters::now()
+{
+    // read without streams, so that the accounting itself does not allocate
+    io_counters result;
+    char buffer[512];
+    int fd = ::open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return result;
+    }
+    auto size = ::read(fd, buffer, sizeof(buffer) - 1);
+    ::close(fd);
+    if (size <= 0)
+    {
+        return result;
+    }
+    buffer[size] = '\0';
+
+    auto field = [&buffer](const char* key) -> uint64_t {
+        auto pos = std::strstr(buffer, key);
+        return pos ? std::strtoull(pos + std::strlen(key), nullptr, 10) : 0;
+    };
+    result.read_chars = field("rchar:");
+    result.written_chars = field("wchar:");
+    return result;
+}
+
+uint64_t files::total() const
+{
+    uint64_t sum = 0;
+    for (const auto& entry : sizes)
+    {
+        sum += entry.second;
+    }
+    return sum;
+}
+
+files files::measure(const std::filesystem::path& metric_path)
+{
+    files result;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(metric_path, ec))
+    {
+        if (entry.is_regular_file(ec))
+        {
+            result.sizes[entry.path().filename().string()] = entry.file_size(ec);
+        }
+    }
+    return result;
+}
+
+Report::Report(const std::string& name, const std::filesystem::path& metric_path)
+: name_(name), metric_path_(metric_path), before_(files::measure(metric_path))
+{
+}
+
+uint64_t Report::output_bytes() const
+{
+    auto after = files::measure(metric_path_).total();
+    return after - std::min(before_.total(), after);
+}
+
+void Report::print(uint64_t rows) const
+{
+    auto after = files::measure(metric_path_);
+    auto raw_bytes = rows * raw_row_bytes;
+    auto ratio = [raw_bytes](uint64_t bytes) {
+        return raw_bytes ? static_cast<double>(bytes) / raw_bytes : 0.;
+    };
+
+    for (const auto& [file, size] : after.sizes)
+    {
+        uint64_t previous = 0;
+        if (auto it = before_.sizes.find(file); it != before_.sizes.end())
+        {
+            previous = std::min(it->second, size);
+        }
+        std::cout << "[" << name_ << "] " << file << ": " << size - previous << " bytes written, "
+                  << size << " bytes total" << std::endl;
+    }
+    auto grown = output_bytes();
+    std::cout << "[" << name_ << "] raw input " << raw_bytes << " bytes, output " << grown
+              << " bytes (" << ratio(grown) << "x), physical writes " << written_
+              << " bytes, write amplification " << ratio(written_) << std::endl;
+}
+} // namespace footprint
@@ -0,0 +1,98 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+
+#include <cstdint>
+
+// Size of the HTA files of a metric and the I/O performed to write them
+namespace footprint
+{
+// I/O counters of the calling thread from /proc/thread-self/io. The chars counters include all
+// read / write syscalls, i.e. also data that is rewritten or only hits the page cache.
+struct io_counters
+{
+    uint64_t read_chars = 0;
+    uint64_t written_chars = 0;
+
+    static io_counters now();
+};
+
+// Bytes per file (i.e. per HTA level) in the directory of a metric
+struct files
+{
+    std::map<std::string, uint64_t> sizes;
+
+    uint64_t total() const;
+
+    static files measure(const std::filesystem::path& metric_path);
+};
+
+// Accumulates the physical bytes written by the HTA writer and reports the footprint of the
+// import relative to the raw input of 16 bytes (timestamp and value) per row
+class Report
+{
+public:
+    static constexpr uint64_t raw_row_bytes = 16;
+
+    Report(const std::string& name, const std::filesystem::path& metric_path);
+
+    void begin_write()
+    {
+        mark_ = io_counters::now().written_chars;
+    }
+
+    void end_write()
+    {
+        written_ += io_counters::now().written_chars - mark_;
+    }
+
+    uint64_t physical_bytes() const
+    {
+        return written_;
+    }
+
+    // growth of the metric directory since construction
+    uint64_t output_bytes() const;
+
+    void print(uint64_t rows) const;
+
+private:
+    std::string name_;
+    std::filesystem::path metric_path_;
+    files before_;
+    uint64_t mark_ = 0;
+    uint64_t written_ = 0;
+};
+} // namespace footprint
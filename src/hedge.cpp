@@ -0,0 +1,282 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "hedge.hpp"
+
+#include <cppconn/prepared_statement.h>
+#include <cppconn/resultset.h>
+#include <cppconn/statement.h>
+
+// The header uses removed exception specification... so we must use this ugly workaround
+#define throw(...)
+#include <mysql_driver.h>
+#undef throw
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+// queries before the latency distribution is considered known
+constexpr std::size_t warmup_queries = 10;
+} // namespace
+
+uint64_t connection_id(sql::Connection& db)
+{
+    std::unique_ptr<sql::Statement> stmt(db.createStatement());
+    std::unique_ptr<sql::ResultSet> result(stmt->executeQuery("SELECT CONNECTION_ID()"));
+    if (!result->next())
+    {
+        throw std::runtime_error("Failed to query the connection id.");
+    }
+    return result->getUInt64(1);
+}
+
+HedgedQuery::connection::connection(sql::Connection& db,
+                                    std::unique_ptr<sql::PreparedStatement> stmt, uint64_t id)
+: db(db), stmt(std::move(stmt)), id(id)
+{
+}
+
+HedgedQuery::HedgedQuery(sql::Connection& primary, sql::Connection* hedge,
+                         const std::string& query, double percentile, connect_function connect)
+: query_(query), percentile_(percentile), connect_(std::move(connect))
+{
+    if (percentile_ < 0 || percentile_ >= 1)
+    {
+        throw std::invalid_argument("hedge percentile must be in (0, 1), e.g. 0.95, not " +
+                                    std::to_string(percentile_));
+    }
+    prepare(primary, hedge);
+}
+
+void HedgedQuery::prepare(sql::Connection& primary, sql::Connection* hedge)
+{
+    connections_.clear();
+    // the threads refer to the elements, which must not move
+    connections_.reserve(2);
+    connections_.emplace_back(
+        primary, std::unique_ptr<sql::PreparedStatement>(primary.prepareStatement(query_)), 0);
+    if (hedge && percentile_ > 0)
+    {
+        connections_.emplace_back(
+            *hedge, std::unique_ptr<sql::PreparedStatement>(hedge->prepareStatement(query_)),
+            connection_id(*hedge));
+        connections_[0].id = connection_id(primary);
+    }
+}
+
+void HedgedQuery::release()
+{
+    finish();
+    connections_.clear();
+}
+
+void HedgedQuery::reconnect(sql::Connection& primary, sql::Connection* hedge)
+{
+    prepare(primary, hedge);
+}
+
+HedgedQuery::~HedgedQuery()
+{
+    finish();
+}
+
+void HedgedQuery::finish()
+{
+    for (std::size_t index = 0; index < connections_.size(); index++)
+    {
+        wait_idle(index);
+    }
+}
+
+void HedgedQuery::wait_idle(std::size_t index)
+{
+    auto& c = connections_[index];
+    if (!c.thread.joinable())
+    {
+        return;
+    }
+    bool running;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running = !c.done;
+    }
+    // the connection is needed again, so without a successful KILL this waits for the query
+    if (running && !cancel(index))
+    {
+        std::cerr << "waiting for a hedged query that could not be cancelled" << std::endl;
+    }
+    c.thread.join();
+}
+
+std::chrono::duration<double> HedgedQuery::threshold() const
+{
+    auto latencies = latencies_;
+    auto index = static_cast<std::ptrdiff_t>(percentile_ * (latencies.size() - 1));
+    auto nth = latencies.begin() + index;
+    std::nth_element(latencies.begin(), nth, latencies.end());
+    return std::chrono::duration<double>(*nth);
+}
+
+std::unique_ptr<sql::ResultSet> HedgedQuery::execute(const bind_function& bind)
+{
+    if (connections_.size() > 1 && latencies_.size() >= warmup_queries)
+    {
+        return execute_hedged(bind);
+    }
+
+    wait_idle(0);
+    auto begin = clock_type::now();
+    auto& stmt = *connections_[0].stmt;
+    bind(stmt);
+    std::unique_ptr<sql::ResultSet> result(stmt.executeQuery());
+    latencies_.push_back(std::chrono::duration<double>(clock_type::now() - begin).count());
+    return result;
+}
+
+void HedgedQuery::start(std::size_t index, const bind_function& bind)
+{
+    auto& c = connections_[index];
+    c.result.reset();
+    c.error = nullptr;
+    c.done = false;
+    bind(*c.stmt);
+    c.thread = std::thread([this, &c]() {
+        // the MySQL client library needs per-thread initialization
+        auto driver = sql::mysql::get_driver_instance();
+        driver->threadInit();
+        std::unique_ptr<sql::ResultSet> result;
+        std::exception_ptr error;
+        try
+        {
+            result.reset(c.stmt->executeQuery());
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        driver->threadEnd();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        c.result = std::move(result);
+        c.error = error;
+        c.done = true;
+        finished_.notify_all();
+    });
+}
+
+bool HedgedQuery::cancel(std::size_t index)
+{
+    // The KILL must go to the server running the query, the hedge connection may be to a
+    // replica, where the connection id of the primary names an unrelated session.
+    auto& c = connections_[index];
+    if (!connect_)
+    {
+        return false;
+    }
+    try
+    {
+        if (!c.control)
+        {
+            c.control = connect_(index == 1);
+        }
+        std::unique_ptr<sql::Statement> stmt(c.control->createStatement());
+        stmt->execute("KILL QUERY " + std::to_string(c.id));
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "failed to cancel hedged query: " << e.what() << std::endl;
+        c.control.reset();
+        return false;
+    }
+}
+
+std::unique_ptr<sql::ResultSet> HedgedQuery::execute_hedged(const bind_function& bind)
+{
+    // a query left running by the previous call must end before its connection is reused
+    finish();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto begin = clock_type::now();
+    start(0, bind);
+    auto& attempts = connections_;
+    std::size_t winner = 0;
+    bool hedged = false;
+    if (!finished_.wait_for(lock, threshold(), [&]() { return attempts[0].done; }))
+    {
+        hedged = true;
+        hedged_++;
+        start(1, bind);
+        // the first successful result wins, errors only count if both attempts fail
+        finished_.wait(lock, [&]() {
+            return (attempts[0].done && (!attempts[0].error || attempts[1].done)) ||
+                   (attempts[1].done && (!attempts[1].error || attempts[0].done));
+        });
+        winner = (attempts[0].done && !attempts[0].error) ? 0 : 1;
+        if (attempts[winner].error)
+        {
+            // both failed, report the error of the primary
+            winner = 0;
+        }
+    }
+    latencies_.push_back(std::chrono::duration<double>(clock_type::now() - begin).count());
+
+    auto loser = 1 - winner;
+    bool running = hedged && !attempts[loser].done;
+    lock.unlock();
+
+    wait_idle(winner);
+    if (hedged && (!running || cancel(loser)))
+    {
+        // finished or killed, so this returns right away
+        connections_[loser].thread.join();
+    }
+    else if (running)
+    {
+        // the next call or finish() retries the KILL before it needs the connection again
+        std::cerr << "hedged query could not be cancelled, it keeps running in the background"
+                  << std::endl;
+    }
+
+    if (winner == 1)
+    {
+        hedge_wins_++;
+    }
+    if (attempts[winner].error)
+    {
+        std::rethrow_exception(attempts[winner].error);
+    }
+    return std::move(attempts[winner].result);
+}
@@ -0,0 +1,136 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+namespace sql
+{
+class Connection;
+class PreparedStatement;
+class ResultSet;
+} // namespace sql
+
+// id of the connection on the server, as needed to kill its query from another connection
+uint64_t connection_id(sql::Connection& db);
+
+// Runs the chunk query on the primary connection and, once it takes longer than the given
+// percentile of the previous chunk queries, issues the same query on the hedge connection.
+// The first result wins and the other query is killed, so a single slow query (buffer pool
+// misses, replica lag) no longer stalls the import.
+class HedgedQuery
+{
+public:
+    using bind_function = std::function<void(sql::PreparedStatement&)>;
+    // opens another connection to the server of the primary (false) or hedge (true) connection
+    using connect_function = std::function<std::unique_ptr<sql::Connection>(bool hedge)>;
+
+    // hedge may be null or percentile 0 to disable hedging, otherwise the percentile must be in
+    // (0, 1). connect is needed to cancel the losing query on its own server.
+    HedgedQuery(sql::Connection& primary, sql::Connection* hedge, const std::string& query,
+                double percentile, connect_function connect = {});
+    ~HedgedQuery();
+
+    // bind sets the parameters, it is called for each connection the query is issued on
+    std::unique_ptr<sql::ResultSet> execute(const bind_function& bind);
+
+    // waits for queries that could not be cancelled, afterwards the connections are idle
+    void finish();
+
+    // Waits as finish() and drops the statements, so that the connections can be closed, e.g.
+    // during a pause. reconnect() then continues on new connections.
+    void release();
+    void reconnect(sql::Connection& primary, sql::Connection* hedge);
+
+    // Forgets the previous latencies, e.g. once the chunk size changes. Hedging waits for the
+    // warmup queries again.
+    void reset_latencies()
+    {
+        latencies_.clear();
+    }
+
+    uint64_t hedged() const
+    {
+        return hedged_;
+    }
+
+    uint64_t hedge_wins() const
+    {
+        return hedge_wins_;
+    }
+
+private:
+    struct connection
+    {
+        connection(sql::Connection& db, std::unique_ptr<sql::PreparedStatement> stmt,
+                   uint64_t id);
+
+        sql::Connection& db;
+        std::unique_ptr<sql::PreparedStatement> stmt;
+        uint64_t id;
+        // to the same server, opened on demand for KILL QUERY
+        std::unique_ptr<sql::Connection> control;
+        // the query running in the background, guarded by mutex_
+        std::thread thread;
+        std::unique_ptr<sql::ResultSet> result;
+        std::exception_ptr error;
+        bool done = false;
+    };
+
+    void prepare(sql::Connection& primary, sql::Connection* hedge);
+    std::unique_ptr<sql::ResultSet> execute_hedged(const bind_function& bind);
+    void start(std::size_t index, const bind_function& bind);
+    bool cancel(std::size_t index);
+    // joins the thread of the connection, a query still running is cancelled first
+    void wait_idle(std::size_t index);
+    std::chrono::duration<double> threshold() const;
+
+    std::vector<connection> connections_;
+    std::string query_;
+    double percentile_;
+    connect_function connect_;
+    std::mutex mutex_;
+    std::condition_variable finished_;
+    // latencies of the previous chunk queries in seconds
+    std::vector<double> latencies_;
+    uint64_t hedged_ = 0;
+    uint64_t hedge_wins_ = 0;
+};
@@ -0,0 +1,85 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sink.hpp"
+
+namespace
+{
+nlohmann::json reduce_config(nlohmann::json config, const std::string& metric)
+{
+    // opening every configured metric is expensive, so only keep the one we write
+    for (auto metric_config : config["metrics"])
+    {
+        if (metric_config["name"] == metric)
+        {
+            config["metrics"] = nlohmann::json::array({ metric_config });
+            break;
+        }
+    }
+    return config;
+}
+} // namespace
+
+HtaSink::HtaSink(nlohmann::json config, const std::string& metric)
+: metric_(metric), path_(config["path"].get<std::string>()),
+  directory_(reduce_config(config, metric))
+{
+}
+
+void HtaSink::write(const Batch& batch)
+{
+    if (!out_metric_)
+    {
+        // opened by the writer thread, which is the only one using it
+        out_metric_ = &directory_[metric_];
+    }
+    for (const auto& tv : batch.values)
+    {
+        out_metric_->insert(tv);
+    }
+}
+
+void HtaSink::flush()
+{
+    if (out_metric_)
+    {
+        out_metric_->flush();
+    }
+}
+
+std::string HtaSink::name() const
+{
+    return metric_ + " -> " + path_.string();
+}
+
+std::filesystem::path HtaSink::metric_path() const
+{
+    return path_ / metric_;
+}
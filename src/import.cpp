@@ -0,0 +1,952 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "import.hpp"
+#include "alloc_stats.hpp"
+#include "dump.hpp"
+#include "hedge.hpp"
+#include "numa.hpp"
+#include "profile.hpp"
+#include "shard.hpp"
+#include "writer.hpp"
+
+#ifdef HTA_IMPORT_ARROW
+#include "arrow_sink.hpp"
+#endif
+
+#include <hta/ostream.hpp>
+
+#include <cppconn/prepared_statement.h>
+#include <cppconn/resultset.h>
+#include <cppconn/statement.h>
+
+// The header uses removed exception specification... so we must use this ugly workaround
+#define throw(...)
+#include <mysql_driver.h>
+#undef throw
+
+#include <boost/timer/timer.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <thread>
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+
+using json = nlohmann::json;
+
+namespace
+{
+// the MySQL client library needs per-thread initialization when used from multiple threads
+struct driver_thread
+{
+    explicit driver_thread(sql::Driver* driver) : driver(driver)
+    {
+        driver->threadInit();
+    }
+
+    ~driver_thread()
+    {
+        driver->threadEnd();
+    }
+
+    sql::Driver* driver;
+};
+
+// rows fetched per chunk while the statistics for the chunk plan are not yet known
+constexpr uint64_t initial_chunk_rows = 100000;
+
+// shows the queues of the writers in the status for the duration of an import
+struct status_queues
+{
+    status_queues(std::vector<std::unique_ptr<Writer>>& writers, Status& status)
+    : writers(writers), status(status)
+    {
+        for (const auto& writer : writers)
+        {
+            const auto* w = writer.get();
+            status.add_queue(w->name(), [w]() { return w->queue_depth(); });
+        }
+    }
+
+    ~status_queues()
+    {
+        for (const auto& writer : writers)
+        {
+            status.remove_queue(writer->name());
+        }
+    }
+
+    std::vector<std::unique_ptr<Writer>>& writers;
+    Status& status;
+};
+
+// false for values that are skipped, throws for implausible values
+bool accept_value(const std::string& metric, hta::TimePoint time, double value,
+                  hta::TimePoint& previous_time)
+{
+    if (time <= previous_time)
+    {
+        std::cout << "Skipping non-monotonous timestamp " << time << std::endl;
+        return false;
+    }
+    previous_time = time;
+    if (value > 1e12 || value < -1e12)
+    {
+        std::cerr << "[" << metric << "] extreme value " << value << std::endl;
+        throw std::runtime_error("Value exceeds expectation.");
+    }
+    return true;
+}
+
+// every writer gets the same batch, it is released once the slowest one is done
+void deliver(std::shared_ptr<Batch> batch, std::vector<std::unique_ptr<Writer>>& writers,
+             const import_options& options)
+{
+    for (auto& writer : writers)
+    {
+        writer->push(batch);
+    }
+    if (options.route)
+    {
+        options.route(std::move(batch));
+    }
+}
+
+// called at chunk boundaries, waits while paused and throws if a stop is requested
+void checkpoint(const import_options& options, Status& status)
+{
+    if (options.pause_requested && *options.pause_requested)
+    {
+        // the writers drain their queues meanwhile
+        status.set_phase("paused");
+        std::cout << "[" << options.metric << "] paused" << std::endl;
+        while (*options.pause_requested && !(options.stop_requested && *options.stop_requested))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        std::cout << "[" << options.metric << "] resumed" << std::endl;
+    }
+    if (options.stop_requested && *options.stop_requested)
+    {
+        throw std::runtime_error("Import stopped.");
+    }
+}
+
+// Bytes the server sent on this connection, i.e. received by the importer including the protocol
+// overhead. The I/O counters of the process cannot attribute them to one import, the client
+// library reads from its sockets on the import, statistics and hedge threads.
+uint64_t bytes_received(sql::Connection& db)
+{
+    std::unique_ptr<sql::Statement> stmt(db.createStatement());
+    std::unique_ptr<sql::ResultSet> result(
+        stmt->executeQuery("SHOW SESSION STATUS LIKE 'Bytes_sent'"));
+    return result->next() ? result->getUInt64(2) : 0;
+}
+
+// bytes received on the connections of one import, which must be idle for both calls
+class ReceivedBytes
+{
+public:
+    explicit ReceivedBytes(std::vector<sql::Connection*> connections)
+    {
+        for (auto db : connections)
+        {
+            add(db);
+        }
+    }
+
+    // counts the bytes received on the connection from now on
+    void add(sql::Connection* db)
+    {
+        if (db)
+        {
+            begin_.emplace_back(db, bytes_received(*db));
+        }
+    }
+
+    // keeps the bytes received so far, but stops counting, e.g. before the connection is closed
+    void release(sql::Connection* db)
+    {
+        for (auto it = begin_.begin(); it != begin_.end(); ++it)
+        {
+            if (it->first == db)
+            {
+                released_ += bytes_received(*db) - it->second;
+                begin_.erase(it);
+                return;
+            }
+        }
+    }
+
+    uint64_t total() const
+    {
+        uint64_t sum = released_;
+        for (const auto& [db, begin] : begin_)
+        {
+            sum += bytes_received(*db) - begin;
+        }
+        return sum;
+    }
+
+private:
+    std::vector<std::pair<sql::Connection*, uint64_t>> begin_;
+    uint64_t released_ = 0;
+};
+
+// Kills the statistics query if the import ends before it completed, e.g. on an error or a
+// stop request. Otherwise the destructor of the future waits for the full table scan.
+class StatsCancellation
+{
+public:
+    StatsCancellation(const std::string& metric, const std::future<stats>& pending, uint64_t id,
+                      const HedgedQuery::connect_function& connect, sql::Connection* fallback)
+    : metric_(metric), pending_(pending), id_(id), connect_(connect), fallback_(fallback)
+    {
+    }
+
+    ~StatsCancellation()
+    {
+        if (!pending_.valid() ||
+            pending_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            return;
+        }
+        try
+        {
+            std::unique_ptr<sql::Connection> control;
+            auto db = fallback_;
+            if (connect_)
+            {
+                control = connect_(false);
+                db = control.get();
+            }
+            if (!db)
+            {
+                return;
+            }
+            std::unique_ptr<sql::Statement> stmt(db->createStatement());
+            stmt->execute("KILL QUERY " + std::to_string(id_));
+            std::cout << "[" << metric_ << "] cancelled the statistics query" << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "[" << metric_ << "] failed to cancel the statistics query: " << e.what()
+                      << std::endl;
+        }
+    }
+
+private:
+    const std::string& metric_;
+    const std::future<stats>& pending_;
+    uint64_t id_;
+    const HedgedQuery::connect_function& connect_;
+    // to the same server, but only idle if no hedged query may still run on it
+    sql::Connection* fallback_;
+};
+
+// CPU time of the calling thread since begin and of the writer threads
+void account_cpu(import_report& report, const thread_cpu& begin,
+                 const std::vector<std::unique_ptr<Writer>>& writers)
+{
+    auto now = thread_cpu::now();
+    auto user = now.user - begin.user;
+    auto system = now.system - begin.system;
+    for (const auto& writer : writers)
+    {
+        user += writer->cpu().user;
+        system += writer->cpu().system;
+    }
+    report.cpu_time_user = user;
+    report.cpu_time_system = system;
+}
+
+// waits for the writers and completes the report, except for the bytes read
+void finish(const std::string& metric, std::vector<std::unique_ptr<Writer>>& writers,
+            import_report& report, Status& status, PhaseTimer& phases,
+            const boost::timer::cpu_timer& timer, const alloc_stats::Accounting& allocations,
+            uint64_t row)
+{
+    status.set_phase("finish");
+    for (auto& writer : writers)
+    {
+        writer->finish();
+    }
+    phases.account("queue");
+
+    std::cout << "[" << metric << "] completed import of " << row << " rows\n";
+    std::cout << timer.format() << std::endl;
+    allocations.report_total(row);
+    for (const auto& writer : writers)
+    {
+        writer->footprint().print(row);
+        writer->allocations().report_total(row);
+        report.bytes_written =
+            report.bytes_written.value_or(0) + writer->footprint().physical_bytes();
+        report.output_bytes = report.output_bytes.value_or(0) + writer->footprint().output_bytes();
+        // summed over all writers, which run in parallel
+        report.phases["insert"] += writer->insert_seconds();
+        report.phases["flush"] += writer->flush_seconds();
+    }
+    report.rows = row;
+    report.wall_time = timer.elapsed().wall / 1e9;
+}
+} // namespace
+
+stats stats_query(sql::Connection& db, const std::string metric)
+{
+    auto query =
+        std::string("SELECT COUNT(`timestamp`), MIN(`timestamp`), MAX(`timestamp`) FROM ") + metric;
+    auto stmt = std::unique_ptr<sql::PreparedStatement>(db.prepareStatement(query));
+    auto result = std::unique_ptr<sql::ResultSet>(stmt->executeQuery());
+    assert(result->next());
+    stats ret;
+    ret.count = result->getUInt64(1);
+    ret.min_timestamp = result->getUInt64(2);
+    ret.max_timestamp = result->getUInt64(3);
+    return ret;
+}
+
+std::string packed_query(const std::string& table)
+{
+    return std::string("SELECT timestamp DIV ? AS slice, COUNT(*), ") +
+           "GROUP_CONCAT(timestamp - ?, ' ', IFNULL(value, 0) ORDER BY timestamp SEPARATOR ' ') " +
+           "FROM " + table + " WHERE timestamp >= ? AND timestamp < ? " +
+           "GROUP BY slice ORDER BY slice";
+}
+
+void import(sql::Connection& in_db, std::vector<std::unique_ptr<Writer>>& writers,
+            const import_options& options, import_report& report, Status& status,
+            sql::Connection* hedge_db, sql::Connection* stats_db,
+            HedgedQuery::connect_function connect)
+{
+    const auto& in_metric_name = options.import_metric;
+    const auto& out_metric_name = options.metric;
+    auto min_timestamp = options.min_timestamp;
+    auto max_timestamp = options.max_timestamp;
+    auto max_limit = options.chunk_size;
+
+    boost::timer::cpu_timer timer;
+    alloc_stats::Accounting allocations(out_metric_name, options.report_allocations);
+    PhaseTimer phases(report);
+    // the statistics connection is only busy while its query runs in the background
+    ReceivedBytes received({ &in_db, hedge_db, stats_db });
+
+    status.set_metric(out_metric_name, in_metric_name);
+    status_queues status_queues_guard(writers, status);
+
+    uint64_t row = 0;
+    hta::TimePoint previous_time;
+    uint64_t current_dataheap_timestamp;
+
+    std::string query = std::string("SELECT timestamp, value FROM ") + in_metric_name +
+                        " WHERE timestamp >= ? AND timestamp < ?" +
+                        " ORDER BY timestamp ASC LIMIT ?";
+
+    bool packed = options.packed_rows > 0;
+    auto prepare_session = [&](sql::Connection& db) {
+        if (packed)
+        {
+            std::unique_ptr<sql::Statement> set_stmt(db.createStatement());
+            set_stmt->execute("SET SESSION group_concat_max_len = 1073741824");
+            report.queries++;
+        }
+    };
+    if (packed)
+    {
+        report.query_mode = "packed";
+        query = packed_query(in_metric_name);
+    }
+    prepare_session(in_db);
+
+    HedgedQuery chunk_query(in_db, hedge_db, query, options.hedge_percentile, connect);
+
+    // A paused import closes its chunk connections, so that it holds no connections of the
+    // source while the imports that preempted it run, and reopens them on resume. A statistics
+    // query that is still running keeps its connection. Without connect, the idle connections
+    // are kept.
+    std::unique_ptr<sql::Connection> reopened_db;
+    std::unique_ptr<sql::Connection> reopened_hedge;
+    sql::Connection* db = &in_db;
+    auto pause = [&]() {
+        if (!connect || !options.pause_requested || !*options.pause_requested)
+        {
+            checkpoint(options, status);
+            return;
+        }
+        chunk_query.release();
+        received.release(db);
+        received.release(hedge_db);
+        db->close();
+        if (hedge_db)
+        {
+            hedge_db->close();
+        }
+        checkpoint(options, status);
+
+        reopened_db = connect(false);
+        db = reopened_db.get();
+        if (hedge_db)
+        {
+            reopened_hedge = connect(true);
+            hedge_db = reopened_hedge.get();
+        }
+        prepare_session(*db);
+        chunk_query.reconnect(*db, hedge_db);
+        received.add(db);
+        received.add(hedge_db);
+    };
+
+    // The statistics of the table determine the chunk plan. They need a full scan of the
+    // table, so with a separate connection they run in the background, while the first chunks
+    // are streamed from the low end of the range with a conservative row limit.
+    // Packed mode needs the density for its slices, so it waits for them.
+    bool planned = false;
+    uint64_t chunk_timedelta = 0;
+    uint64_t slice_timedelta = 1;
+    uint64_t current_timestamp = min_timestamp;
+    if (!max_timestamp)
+    {
+        max_timestamp = std::numeric_limits<int64_t>::max();
+    }
+    auto plan = [&](const stats& stats) {
+        current_timestamp = std::max(current_timestamp, stats.min_timestamp);
+        max_timestamp = std::min(max_timestamp, stats.max_timestamp + 1);
+
+        auto sampling_interval =
+            static_cast<double>(stats.max_timestamp - stats.min_timestamp) / stats.count;
+        chunk_timedelta =
+            sampling_interval * max_limit / 2; // Use 1/2 to not run into limit too often
+        slice_timedelta = std::max<uint64_t>(sampling_interval * options.packed_rows, 1);
+        planned = true;
+        // the latencies of the chunks bounded by the row limit only are not comparable
+        chunk_query.reset_latencies();
+
+        std::cout << "[" << out_metric_name << "] importing from " << in_metric_name
+                  << " using a chunk time of " << chunk_timedelta << std::endl;
+    };
+
+    std::future<stats> pending_stats;
+    // declared after the future, so that the query is killed before the future waits for it
+    std::optional<StatsCancellation> cancel_stats;
+    if (stats_db && !packed)
+    {
+        cancel_stats.emplace(out_metric_name, pending_stats, connection_id(*stats_db), connect,
+                             hedge_db ? nullptr : &in_db);
+        status.begin_query();
+        pending_stats = std::async(std::launch::async, [stats_db, &in_metric_name, &status]() {
+            driver_thread thread_guard(sql::mysql::get_driver_instance());
+            struct end_query
+            {
+                Status& status;
+                ~end_query()
+                {
+                    status.end_query();
+                }
+            } end_query_guard{ status };
+            return stats_query(*stats_db, in_metric_name);
+        });
+        std::cout << "[" << out_metric_name << "] starting import from " << in_metric_name
+                  << " while the statistics are collected" << std::endl;
+    }
+    else
+    {
+        status.set_phase("stats");
+        status.begin_query();
+        auto stats = stats_query(in_db, in_metric_name);
+        status.end_query();
+        plan(stats);
+    }
+    report.queries++;
+    allocations.account(alloc_stats::phase::stats);
+    phases.account("stats");
+
+    std::shared_ptr<Batch> batch;
+    auto add_value = [&](uint64_t timestamp, double value) {
+        current_dataheap_timestamp = timestamp;
+        row++;
+        hta::TimePoint hta_time{ hta::duration_cast(
+            std::chrono::milliseconds(current_dataheap_timestamp)) };
+        if (accept_value(out_metric_name, hta_time, value, previous_time))
+        {
+            batch->values.push_back({ hta_time, value });
+        }
+    };
+
+    while (true)
+    {
+        if (!planned &&
+            (current_timestamp >= max_timestamp ||
+             pending_stats.wait_for(std::chrono::seconds(0)) == std::future_status::ready))
+        {
+            status.set_phase("stats");
+            plan(pending_stats.get());
+            phases.account("stats");
+        }
+
+        if (current_timestamp >= max_timestamp)
+        {
+            report.hedged_queries = chunk_query.hedged();
+            report.hedge_wins = chunk_query.hedge_wins();
+            finish(out_metric_name, writers, report, status, phases, timer, allocations, row);
+            // the counters of a connection are only final once its query ended
+            chunk_query.finish();
+            report.bytes_read = received.total();
+            return;
+        }
+
+        // until the plan is known, chunks are only bounded by the row limit
+        uint64_t next_timestamp =
+            planned ? std::min(current_timestamp + chunk_timedelta, max_timestamp) : max_timestamp;
+        uint64_t limit = planned ? max_limit : std::min(max_limit, initial_chunk_rows);
+
+        auto bind = [&](sql::PreparedStatement& stmt) {
+            if (packed)
+            {
+                // no limit, the chunk time already bounds the expected number of values
+                stmt.setUInt64(1, slice_timedelta);
+                stmt.setUInt64(2, current_timestamp);
+                stmt.setUInt64(3, current_timestamp);
+                stmt.setUInt64(4, next_timestamp);
+            }
+            else
+            {
+                stmt.setUInt64(1, current_timestamp);
+                stmt.setUInt64(2, next_timestamp);
+                stmt.setUInt64(3, limit);
+            }
+        };
+
+        status.set_phase("query");
+        status.begin_query();
+        auto hedged_before = chunk_query.hedged();
+        auto res = chunk_query.execute(bind);
+        status.end_query();
+        allocations.account(alloc_stats::phase::query);
+        phases.account("query");
+        report.queries += 1 + chunk_query.hedged() - hedged_before;
+
+        if (res->rowsCount() == 0)
+        {
+            current_timestamp = next_timestamp;
+            continue;
+        }
+        auto chunk_begin_row = row;
+        batch = std::make_shared<Batch>();
+        status.set_phase("decode");
+        if (packed)
+        {
+            batch->values.reserve(res->rowsCount() * options.packed_rows);
+            while (res->next())
+            {
+                std::string values = res->getString(3);
+                decode_packed_row(values, res->getUInt64(2), current_timestamp, add_value);
+            }
+        }
+        else
+        {
+            batch->values.reserve(res->rowsCount());
+            while (res->next())
+            {
+                add_value(res->getUInt64(1), static_cast<double>(res->getDouble(2)));
+            }
+        }
+
+        res.reset();
+        // published once per chunk, the producers of a sharded import would contend per row
+        status.rows(row - chunk_begin_row, current_dataheap_timestamp);
+        allocations.account(alloc_stats::phase::decode);
+        phases.account("decode");
+
+        status.set_phase("queue");
+        deliver(std::move(batch), writers, options);
+        phases.account("queue");
+        std::cout << "[" << out_metric_name << "] " << row << " rows read." << std::endl;
+        allocations.end_chunk(row - chunk_begin_row);
+
+        report.rows = row;
+
+        if (options.progress)
+        {
+            options.progress(row, current_dataheap_timestamp);
+        }
+        pause();
+
+        // a packed chunk is complete, a limited one continues after its last row
+        current_timestamp = packed ? next_timestamp : current_dataheap_timestamp + 1;
+    }
+}
+
+void import_dump(dump::Reader& reader, std::vector<std::unique_ptr<Writer>>& writers,
+                 const import_options& options, import_report& report, Status& status)
+{
+    boost::timer::cpu_timer timer;
+    alloc_stats::Accounting allocations(options.metric, options.report_allocations);
+    PhaseTimer phases(report);
+    report.query_mode = "dump";
+
+    status.set_metric(options.metric, options.import_metric);
+    status_queues status_queues_guard(writers, status);
+    std::cout << "[" << options.metric << "] importing " << reader.chunks()
+              << " dump chunks of " << options.import_metric << std::endl;
+
+    uint64_t row = 0;
+    hta::TimePoint previous_time;
+    while (true)
+    {
+        // the chunks are decoded in the background, this only waits if they are not ready
+        status.set_phase("decode");
+        auto rows = reader.next();
+        if (rows.empty())
+        {
+            break;
+        }
+        auto chunk_begin_row = row;
+        auto batch = std::make_shared<Batch>();
+        batch->values.reserve(rows.size());
+        for (const auto& r : rows)
+        {
+            row++;
+            hta::TimePoint time{ hta::duration_cast(std::chrono::milliseconds(r.timestamp)) };
+            if (accept_value(options.metric, time, r.value, previous_time))
+            {
+                batch->values.push_back({ time, r.value });
+            }
+        }
+        status.rows(rows.size(), rows.back().timestamp);
+        allocations.account(alloc_stats::phase::decode);
+        phases.account("decode");
+
+        status.set_phase("queue");
+        deliver(std::move(batch), writers, options);
+        phases.account("queue");
+        std::cout << "[" << options.metric << "] " << row << " rows read." << std::endl;
+        allocations.end_chunk(row - chunk_begin_row);
+
+        report.rows = row;
+        report.bytes_read = reader.compressed_bytes();
+        if (options.progress)
+        {
+            options.progress(row, rows.back().timestamp);
+        }
+        checkpoint(options, status);
+    }
+    if (reader.merged_chunks() > 0)
+    {
+        std::cout << "[" << options.metric << "] merged " << reader.merged_chunks()
+                  << " dump chunks that overlapped their predecessor" << std::endl;
+    }
+    finish(options.metric, writers, report, status, phases, timer, allocations, row);
+    report.bytes_read = reader.compressed_bytes();
+}
+
+Engine::Engine() : driver_(sql::mysql::get_driver_instance())
+{
+}
+
+std::unique_ptr<sql::Connection> Engine::connect(const json& config, bool hedge)
+{
+    // setup input / import database
+    const auto& conf_import = config["import"];
+    // hedged queries may go to a replica
+    std::string host = conf_import["host"];
+    if (hedge && conf_import.count("hedge_host"))
+    {
+        host = conf_import["hedge_host"];
+    }
+    std::string user = conf_import["user"];
+    std::string password = conf_import["password"];
+    std::string schema = conf_import["database"];
+    std::unique_ptr<sql::Connection> con(driver_->connect(host, user, password));
+    con->setSchema(schema);
+    return con;
+}
+
+void Engine::run(json config, const import_options& options, import_report& report,
+                 Status& status)
+{
+    driver_thread thread_guard(driver_);
+    auto cpu_begin = thread_cpu::now();
+
+    // the statistics, hedge and writer threads inherit the affinity, the batch buffers are first
+    // touched by this thread and thereby allocated on the same node
+    std::optional<numa::ScopedPin> pin;
+    if (options.numa)
+    {
+        numa::Placement placement(options.nic);
+        std::size_t pipeline = options.pipeline >= 0 ? options.pipeline : pipelines_++;
+        pin.emplace(placement.fetch_cpus(pipeline));
+    }
+
+    report.metric = options.metric;
+    report.import_metric = options.import_metric;
+
+    std::unique_ptr<sql::Connection> con;
+    if (options.dump_directory.empty())
+    {
+        con = connect(config);
+    }
+
+    // each output gets its own writer thread and hta::Directory, the source is only read once
+    std::vector<std::unique_ptr<Writer>> writers;
+    auto add_writer = [&writers, &options](std::unique_ptr<Sink> sink) {
+        writers.push_back(std::make_unique<Writer>(std::move(sink), options.report_allocations,
+                                                   options.writer_queue_capacity,
+                                                   options.durable, options.drop_cache));
+    };
+    add_writer(std::make_unique<HtaSink>(config, options.metric));
+    for (const auto& output_config : options.output_configs)
+    {
+        add_writer(std::make_unique<HtaSink>(output_config, options.metric));
+    }
+    if (!options.arrow_output.empty())
+    {
+#ifdef HTA_IMPORT_ARROW
+        add_writer(std::make_unique<ArrowSink>(options.arrow_output, options.metric));
+#else
+        throw std::runtime_error("Arrow output requires a build with -DHTA_IMPORT_ARROW=ON");
+#endif
+    }
+    if (options.profile)
+    {
+        // nothing to make durable
+        writers.push_back(std::make_unique<Writer>(
+            std::make_unique<profile::ProfileSink>(options.metric, report.profile),
+            options.report_allocations, options.writer_queue_capacity));
+    }
+
+    if (!options.dump_directory.empty())
+    {
+        std::string schema = config.count("import") ? config["import"].value("database", "") : "";
+        dump::Reader reader(dump::find_table(options.dump_directory, schema, options.import_metric),
+                            options.dump_threads, options.min_timestamp, options.max_timestamp,
+                            options.drop_cache);
+        import_dump(reader, writers, options, report, status);
+        account_cpu(report, cpu_begin, writers);
+        return;
+    }
+
+    std::unique_ptr<sql::Connection> hedge_con;
+    if (options.hedge_percentile > 0)
+    {
+        hedge_con = connect(config, true);
+    }
+
+    // the statistics query runs concurrently to the first chunks on its own connection
+    std::unique_ptr<sql::Connection> stats_con;
+    if (options.packed_rows == 0)
+    {
+        stats_con = connect(config);
+    }
+
+    import(*con, writers, options, report, status, hedge_con.get(), stats_con.get(),
+           [this, &config](bool hedge) { return connect(config, hedge); });
+    account_cpu(report, cpu_begin, writers);
+}
+
+std::vector<import_report> Engine::run_sharded(json config, const import_options& options,
+                                               const shard_options& shard_options,
+                                               Status& status)
+{
+    std::vector<import_options> jobs;
+    std::vector<std::string> metrics;
+    for (const auto& metric_config : config["metrics"])
+    {
+        auto job = options;
+        job.metric = metric_config["name"];
+        job.import_metric = job.metric;
+        std::replace(job.import_metric.begin(), job.import_metric.end(), '.', '_');
+        job.import_metric = metric_config.value("import_name", job.import_metric);
+        metrics.push_back(job.metric);
+        jobs.push_back(std::move(job));
+    }
+
+    auto shards = shard_options.shards;
+    if (shards == 0)
+    {
+        shards = std::max(1u, std::thread::hardware_concurrency());
+    }
+    auto connections = std::max<std::size_t>(1, std::min(shard_options.connections, jobs.size()));
+    std::optional<numa::Placement> placement;
+    if (options.numa)
+    {
+        placement.emplace(options.nic);
+    }
+    ShardedWriter writer(config, metrics, shards, connections, shard_options.queue_capacity,
+                         shard_options.max_open_metrics, placement ? &*placement : nullptr);
+    std::cout << "importing " << jobs.size() << " metrics over " << connections
+              << " connections into " << shards << " writer shards" << std::endl;
+
+    // Producers prefer metrics whose shard runs on their own node, so batches rarely cross
+    // sockets, and only take metrics of other nodes once their own are done.
+    auto node_count = placement ? placement->node_count() : 1;
+    std::vector<std::vector<std::size_t>> node_jobs(node_count);
+    for (std::size_t index = 0; index < jobs.size(); index++)
+    {
+        auto node = placement ? placement->node_index(writer.shard_of(index)) : 0;
+        node_jobs[node].push_back(index);
+    }
+    std::vector<std::atomic<std::size_t>> next_node_job(node_count);
+    auto take_job = [&](std::size_t node) -> std::optional<std::size_t> {
+        for (std::size_t i = 0; i < node_count; i++)
+        {
+            auto n = (node + i) % node_count;
+            auto next = next_node_job[n]++;
+            if (next < node_jobs[n].size())
+            {
+                return node_jobs[n][next];
+            }
+        }
+        return std::nullopt;
+    };
+
+    // each producer reports the metric it imports in a status of its own
+    std::vector<Status> producer_status(connections);
+    struct remove_producers
+    {
+        Status& status;
+        std::vector<Status>& producers;
+        ~remove_producers()
+        {
+            for (const auto& producer : producers)
+            {
+                status.remove_producer(producer);
+            }
+        }
+    } remove_guard{ status, producer_status };
+    for (const auto& producer : producer_status)
+    {
+        status.add_producer(producer);
+    }
+    status.set_phase("import");
+
+    std::vector<import_report> reports(jobs.size());
+    std::vector<std::thread> producers;
+    for (std::size_t producer = 0; producer < connections; producer++)
+    {
+        producers.emplace_back([&, producer]() {
+            auto node = placement ? placement->fetch_node_index(producer) : 0;
+            if (placement)
+            {
+                numa::pin(placement->fetch_cpus(producer));
+            }
+
+            struct close_producer
+            {
+                ShardedWriter& writer;
+                std::size_t producer;
+                ~close_producer()
+                {
+                    writer.close(producer);
+                }
+            } close_guard{ writer, producer };
+
+            driver_thread thread_guard(driver_);
+            std::unique_ptr<sql::Connection> con;
+            while (!(options.stop_requested && *options.stop_requested))
+            {
+                auto next = take_job(node);
+                if (!next)
+                {
+                    break;
+                }
+                auto index = *next;
+                auto& job = jobs[index];
+                auto& report = reports[index];
+                report.metric = job.metric;
+                report.import_metric = job.import_metric;
+                job.route = [&writer, producer, index](std::shared_ptr<const Batch> batch) {
+                    writer.push(producer, index, std::move(batch));
+                };
+                try
+                {
+                    if (!con)
+                    {
+                        con = connect(config);
+                    }
+                    // the metrics are written by the shards, only a profile has its own writer
+                    std::vector<std::unique_ptr<Writer>> writers;
+                    if (job.profile)
+                    {
+                        writers.push_back(std::make_unique<Writer>(
+                            std::make_unique<profile::ProfileSink>(job.metric, report.profile),
+                            job.report_allocations, job.writer_queue_capacity));
+                    }
+                    import(*con, writers, job, report, producer_status[producer]);
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "[" << job.metric << "] error: " << e.what() << std::endl;
+                    report.error = e.what();
+                    // the connection may be broken, the next job reconnects
+                    con.reset();
+                }
+            }
+        });
+    }
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    // the errors of the shards are more specific than the ones of the producers
+    status.set_phase("finish");
+    auto errors = writer.finish();
+    for (std::size_t index = 0; index < jobs.size(); index++)
+    {
+        auto& report = reports[index];
+        if (!errors[index].empty())
+        {
+            report.error = errors[index];
+        }
+        if (report.metric.empty())
+        {
+            // not started because of a stop request
+            report.metric = jobs[index].metric;
+            report.import_metric = jobs[index].import_metric;
+            report.error = "Import stopped.";
+        }
+    }
+    return reports;
+}
+
+void Engine::sync(json config, const fleet::options& options, Status& status)
+{
+    driver_thread thread_guard(driver_);
+    auto con = connect(config);
+    fleet::Scheduler scheduler(*con, config, options, status);
+    scheduler.run();
+}
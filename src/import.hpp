@@ -0,0 +1,209 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "fleet.hpp"
+#include "hedge.hpp"
+#include "report.hpp"
+#include "status.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+struct Batch;
+class Writer;
+
+namespace dump
+{
+class Reader;
+} // namespace dump
+
+namespace sql
+{
+class Connection;
+class Driver;
+} // namespace sql
+
+struct stats
+{
+    uint64_t min_timestamp;
+    uint64_t max_timestamp;
+    uint64_t count;
+};
+
+stats stats_query(sql::Connection& db, const std::string metric);
+
+// Query of the packed mode: each result row holds a time slice of values as text
+// "offset value ...", with the timestamps relative to the begin of the chunk. The row count of
+// the slice is sent along to detect truncation by group_concat_max_len. NULL values are sent as
+// 0, which is what the plain mode reads for them.
+std::string packed_query(const std::string& table);
+
+// Decodes one packed result row and calls add(timestamp, value) for each of its count values.
+// Throws if fewer values are decoded, i.e. the row is truncated.
+template <typename Add>
+void decode_packed_row(const std::string& values, uint64_t count, uint64_t begin, Add&& add)
+{
+    const char* pos = values.c_str();
+    char* end;
+    uint64_t decoded = 0;
+    for (; decoded < count; decoded++)
+    {
+        auto offset = std::strtoull(pos, &end, 10);
+        if (end == pos)
+        {
+            break;
+        }
+        pos = end;
+        auto value = std::strtod(pos, &end);
+        if (end == pos)
+        {
+            break;
+        }
+        pos = end;
+        add(begin + offset, value);
+    }
+    if (decoded != count)
+    {
+        throw std::runtime_error("Packed row is truncated, " + std::to_string(decoded) + " of " +
+                                 std::to_string(count) + " values decoded.");
+    }
+}
+
+struct import_options
+{
+    // name of the metric in MetricQ / HTA
+    std::string metric;
+    // name of the dataheap table
+    std::string import_metric;
+    uint64_t min_timestamp = 0;
+    uint64_t max_timestamp = 0;
+    uint64_t chunk_size = 20000000;
+    // if set, the server packs about this many values into one result row, which saves the
+    // per-row protocol overhead, 0 fetches one result row per value
+    uint64_t packed_rows = 0;
+    // if set, chunk queries slower than this percentile of the previous ones (e.g. 0.95) are
+    // issued again on a second connection, to "hedge_host" of the import config if present
+    double hedge_percentile = 0;
+    bool report_allocations = false;
+    // additional hta::Directory configs, written from the same source scan
+    std::vector<nlohmann::json> output_configs;
+    // directory for Arrow IPC files written in the same pass, empty to disable
+    std::string arrow_output;
+    // profile the values into the profile of the report, from an additional writer thread
+    bool profile = false;
+    // batches that may be queued per writer
+    std::size_t writer_queue_capacity = 2;
+    // make every flush durable with fdatasync, issued asynchronously on io_uring where available
+    bool durable = false;
+    // implies durable, drops the synced output from the page cache, so that an import does not
+    // evict the data of other services on the host
+    bool drop_cache = false;
+    // called after each chunk with the number of rows imported so far and the last timestamp
+    std::function<void(uint64_t, uint64_t)> progress;
+    // checked at chunk boundaries, the import throws if set
+    const std::atomic<bool>* stop_requested = nullptr;
+    // checked at chunk boundaries, the import waits while set, with its chunk connections closed
+    const std::atomic<bool>* pause_requested = nullptr;
+    // pin the stages of the import to the CPUs of one NUMA node
+    bool numa = false;
+    // network interface of the source connections, its NUMA node is preferred
+    std::string nic;
+    // index of the import among the ones running in parallel, which chooses its NUMA node,
+    // -1 to count the imports of the engine (only correct if they all share one process)
+    int pipeline = -1;
+    // if set, the metric is read from this MySQL Shell dump set instead of the server
+    std::string dump_directory;
+    // threads decompressing the chunk files of a dump, 0 for one per hardware thread
+    std::size_t dump_threads = 0;
+    // if set, every batch is also handed to this function, which may block for back pressure
+    std::function<void(std::shared_ptr<const Batch>)> route;
+};
+
+struct shard_options
+{
+    // source connections, each importing one metric at a time
+    std::size_t connections = 4;
+    // writer threads, 0 for one per hardware thread
+    std::size_t shards = 0;
+    // batches that may be queued per connection and shard
+    std::size_t queue_capacity = 4;
+    // metrics open at a time, 0 for the limit given by the file descriptors
+    std::size_t max_open_metrics = 0;
+};
+
+// connect opens further connections to the source (false) or hedge (true) server, to cancel
+// queries still running on in_db or hedge_db and to replace them after a pause, which closes them
+void import(sql::Connection& in_db, std::vector<std::unique_ptr<Writer>>& writers,
+            const import_options& options, import_report& report, Status& status,
+            sql::Connection* hedge_db = nullptr, sql::Connection* stats_db = nullptr,
+            HedgedQuery::connect_function connect = {});
+
+// imports the rows of the reader instead of querying the server
+void import_dump(dump::Reader& reader, std::vector<std::unique_ptr<Writer>>& writers,
+                 const import_options& options, import_report& report, Status& status);
+
+// Runs complete imports, as configured by the JSON config of hta_mysql_import.
+// Can be shared between threads, each running its own import.
+class Engine
+{
+public:
+    Engine();
+
+    void run(nlohmann::json config, const import_options& options, import_report& report,
+             Status& status);
+
+    // Imports all metrics of the config in one process, options provides the settings that are
+    // not per metric. The metrics are written by shard threads that own them exclusively.
+    // Returns one report per metric, failed imports have an error set.
+    std::vector<import_report> run_sharded(nlohmann::json config, const import_options& options,
+                                           const shard_options& shard_options, Status& status);
+
+    // keeps all configured metrics in sync until stop is requested
+    void sync(nlohmann::json config, const fleet::options& options, Status& status);
+
+private:
+    std::unique_ptr<sql::Connection> connect(const nlohmann::json& config, bool hedge = false);
+
+    sql::Driver* driver_;
+    // pipelines started so far, for spreading them over the NUMA nodes without
+    // import_options::pipeline
+    std::atomic<std::size_t> pipelines_{ 0 };
+};
@@ -0,0 +1,1041 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "lines.hpp"
+#include "profile.hpp"
+#include "shard.hpp"
+#include "uring.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <cerrno>
+#include <cstdlib>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+}
+
+namespace lines
+{
+namespace
+{
+constexpr std::size_t npos = std::string_view::npos;
+constexpr std::size_t read_block_size = 8 << 20;
+// values per batch handed to the writer
+constexpr std::size_t batch_size = 1 << 20;
+// values read at once from a spilled run while merging, the window shrinks towards the minimum
+// when many runs share the memory
+constexpr std::size_t max_spill_read_size = 1 << 16;
+constexpr std::size_t min_spill_read_size = 1 << 10;
+
+// first c at or after pos that is not escaped by a backslash
+std::size_t find_unescaped(std::string_view s, char c, std::size_t pos = 0)
+{
+    for (; pos < s.size(); pos++)
+    {
+        if (s[pos] == '\\')
+        {
+            pos++;
+        }
+        else if (s[pos] == c)
+        {
+            return pos;
+        }
+    }
+    return npos;
+}
+
+// like find_unescaped, but skips quoted strings
+std::size_t find_unquoted(std::string_view s, char c, std::size_t pos = 0)
+{
+    bool quoted = false;
+    for (; pos < s.size(); pos++)
+    {
+        if (s[pos] == '\\')
+        {
+            pos++;
+        }
+        else if (s[pos] == '"')
+        {
+            quoted = !quoted;
+        }
+        else if (s[pos] == c && !quoted)
+        {
+            return pos;
+        }
+    }
+    return npos;
+}
+
+std::string unescape(std::string_view s)
+{
+    std::string result;
+    result.reserve(s.size());
+    for (std::size_t i = 0; i < s.size(); i++)
+    {
+        if (s[i] == '\\' && i + 1 < s.size())
+        {
+            i++;
+            // OpenMetrics label values escape the line feed
+            result.push_back(s[i] == 'n' ? '\n' : s[i]);
+            continue;
+        }
+        result.push_back(s[i]);
+    }
+    return result;
+}
+
+std::string_view trim(std::string_view s)
+{
+    auto begin = s.find_first_not_of(' ');
+    if (begin == npos)
+    {
+        return {};
+    }
+    return s.substr(begin, s.find_last_not_of(' ') - begin + 1);
+}
+
+int64_t precision(const std::string& unit)
+{
+    if (unit == "ns")
+    {
+        return 1;
+    }
+    if (unit == "us")
+    {
+        return 1000;
+    }
+    if (unit == "ms")
+    {
+        return 1000000;
+    }
+    if (unit == "s")
+    {
+        return 1000000000;
+    }
+    throw std::runtime_error("unknown line_protocol precision: " + unit);
+}
+
+// timestamp in nanoseconds, OpenMetrics timestamps may have a fraction
+int64_t parse_time(std::string_view text, int64_t precision)
+{
+    int64_t integer;
+    auto end = text.data() + text.size();
+    auto parsed = std::from_chars(text.data(), end, integer);
+    if (parsed.ec == std::errc() && parsed.ptr == end)
+    {
+        return integer * precision;
+    }
+    // the text is followed by a separator, which ends strtod
+    char* double_end;
+    auto seconds = std::strtod(text.data(), &double_end);
+    if (double_end != end)
+    {
+        throw std::runtime_error("invalid timestamp: " + std::string(text));
+    }
+    return std::llround(seconds * precision);
+}
+
+// Values of one parser thread by metric. Once its share of the memory is used up, the buffers
+// are sorted and spilled to a file as one run per metric.
+class SpillBuffer
+{
+public:
+    struct run
+    {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    SpillBuffer(std::size_t metrics, std::size_t memory, std::filesystem::path directory)
+    : buffers_(metrics), runs_(metrics),
+      max_values_(std::max<std::size_t>(memory / sizeof(point), 1)),
+      directory_(std::move(directory))
+    {
+    }
+
+    ~SpillBuffer()
+    {
+        if (fd_ >= 0)
+        {
+            close(fd_);
+        }
+    }
+
+    SpillBuffer(const SpillBuffer&) = delete;
+    SpillBuffer& operator=(const SpillBuffer&) = delete;
+
+    void add(std::size_t metric, point value)
+    {
+        buffers_[metric].push_back(value);
+        if (++values_ >= max_values_)
+        {
+            spill();
+        }
+    }
+
+    // sorts the values still in memory, afterwards they are only read
+    void sort()
+    {
+        for (auto& buffer : buffers_)
+        {
+            sort(buffer);
+        }
+    }
+
+    const std::vector<point>& buffer(std::size_t metric) const
+    {
+        return buffers_[metric];
+    }
+
+    const std::vector<run>& runs(std::size_t metric) const
+    {
+        return runs_[metric];
+    }
+
+    int fd() const
+    {
+        return fd_;
+    }
+
+    uint64_t spilled_bytes() const
+    {
+        return end_;
+    }
+
+    // of the values not spilled
+    std::size_t held_bytes() const
+    {
+        return values_ * sizeof(point);
+    }
+
+private:
+    static void sort(std::vector<point>& buffer)
+    {
+        auto earlier = [](const point& a, const point& b) { return a.time < b.time; };
+        // in order series are the common case and need no sort
+        if (!std::is_sorted(buffer.begin(), buffer.end(), earlier))
+        {
+            std::stable_sort(buffer.begin(), buffer.end(), earlier);
+        }
+    }
+
+    void open_file()
+    {
+        auto directory = directory_.empty() ? std::filesystem::temp_directory_path() : directory_;
+        // unnamed, so the file disappears with the process
+        fd_ = ::open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (fd_ < 0)
+        {
+            auto name = (directory / "hta_import_spill.XXXXXX").string();
+            fd_ = mkostemp(name.data(), O_CLOEXEC);
+            if (fd_ >= 0)
+            {
+                unlink(name.c_str());
+            }
+        }
+        if (fd_ < 0)
+        {
+            throw std::system_error(errno, std::generic_category(),
+                                    "spill file in " + directory.string());
+        }
+    }
+
+    void spill()
+    {
+        if (fd_ < 0)
+        {
+            open_file();
+        }
+        for (std::size_t metric = 0; metric < buffers_.size(); metric++)
+        {
+            auto& buffer = buffers_[metric];
+            if (buffer.empty())
+            {
+                continue;
+            }
+            sort(buffer);
+            const auto* data = reinterpret_cast<const char*>(buffer.data());
+            std::size_t size = buffer.size() * sizeof(point);
+            runs_[metric].push_back({ end_, buffer.size() });
+            while (size > 0)
+            {
+                auto written = pwrite(fd_, data, size, end_);
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    throw std::system_error(errno, std::generic_category(), "spill write");
+                }
+                data += written;
+                size -= written;
+                end_ += written;
+            }
+            // released, the next values may go to other metrics
+            std::vector<point>().swap(buffer);
+        }
+        values_ = 0;
+    }
+
+    std::vector<std::vector<point>> buffers_;
+    std::vector<std::vector<run>> runs_;
+    std::size_t max_values_;
+    std::size_t values_ = 0;
+    std::filesystem::path directory_;
+    int fd_ = -1;
+    uint64_t end_ = 0;
+};
+
+// sorted values of a metric from one spilled run or one buffer in memory
+class Cursor
+{
+public:
+    explicit Cursor(const std::vector<point>& buffer)
+    : pos_(buffer.data()), end_(buffer.data() + buffer.size())
+    {
+    }
+
+    Cursor(int fd, const SpillBuffer::run& run, std::size_t read_size)
+    : fd_(fd), offset_(run.offset), remaining_(run.count), read_size_(read_size)
+    {
+        refill();
+    }
+
+    bool done() const
+    {
+        return pos_ == end_;
+    }
+
+    const point& current() const
+    {
+        return *pos_;
+    }
+
+    void advance()
+    {
+        if (++pos_ == end_ && remaining_ > 0)
+        {
+            refill();
+        }
+    }
+
+private:
+    void refill()
+    {
+        auto count = std::min<uint64_t>(remaining_, read_size_);
+        buffer_.resize(count);
+        auto* data = reinterpret_cast<char*>(buffer_.data());
+        std::size_t size = count * sizeof(point);
+        while (size > 0)
+        {
+            auto result = pread(fd_, data, size, offset_);
+            if (result <= 0)
+            {
+                if (result < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("spill file read failed");
+            }
+            data += result;
+            size -= result;
+            offset_ += result;
+        }
+        remaining_ -= count;
+        pos_ = buffer_.data();
+        end_ = pos_ + count;
+    }
+
+    const point* pos_ = nullptr;
+    const point* end_ = nullptr;
+    std::vector<point> buffer_;
+    int fd_ = -1;
+    uint64_t offset_ = 0;
+    uint64_t remaining_ = 0;
+    std::size_t read_size_ = max_spill_read_size;
+};
+
+bool stop(const options& options)
+{
+    return options.stop_requested && *options.stop_requested;
+}
+} // namespace
+
+Rule::Rule(const std::string& pattern)
+{
+    std::size_t pos = 0;
+    while (pos < pattern.size())
+    {
+        auto open = pattern.find('{', pos);
+        if (open == npos)
+        {
+            parts_.push_back({ false, pattern.substr(pos) });
+            break;
+        }
+        auto close = pattern.find('}', open);
+        if (close == npos)
+        {
+            throw std::runtime_error("unterminated placeholder in rule: " + pattern);
+        }
+        if (open > pos)
+        {
+            parts_.push_back({ false, pattern.substr(pos, open - pos) });
+        }
+        parts_.push_back({ true, pattern.substr(open + 1, close - open - 1) });
+        pos = close + 1;
+    }
+}
+
+std::optional<std::string>
+Rule::apply(std::string_view measurement, std::string_view field,
+            const std::vector<std::pair<std::string, std::string>>& tags) const
+{
+    std::string result;
+    for (const auto& part : parts_)
+    {
+        if (!part.placeholder)
+        {
+            result += part.text;
+        }
+        else if (part.text == "measurement")
+        {
+            result += measurement;
+        }
+        else if (part.text == "field")
+        {
+            result += field;
+        }
+        else
+        {
+            auto tag = std::find_if(tags.begin(), tags.end(),
+                                    [&part](const auto& tag) { return tag.first == part.text; });
+            if (tag == tags.end())
+            {
+                return std::nullopt;
+            }
+            result += tag->second;
+        }
+    }
+    return result;
+}
+
+Parser::Parser(const nlohmann::json& config,
+               const std::unordered_map<std::string, std::size_t>& metrics, callback on_value)
+: openmetrics_(config.value("format", "influx") == "openmetrics"),
+  precision_(precision(config.value("precision", openmetrics_ ? "s" : "ns"))),
+  rule_(config.value("name", openmetrics_ ? "{measurement}" : "{measurement}.{field}")),
+  metrics_(metrics), on_value_(std::move(on_value))
+{
+    auto format = config.value("format", "influx");
+    if (format != "influx" && format != "openmetrics")
+    {
+        throw std::runtime_error("unknown line_protocol format: " + format);
+    }
+}
+
+void Parser::feed(std::string_view block)
+{
+    while (!block.empty())
+    {
+        auto end = block.find('\n');
+        auto line = block.substr(0, end);
+        block.remove_prefix(end == npos ? block.size() : end + 1);
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        lines_++;
+        if (openmetrics_)
+        {
+            openmetrics(line);
+        }
+        else
+        {
+            influx(line);
+        }
+    }
+}
+
+std::size_t Parser::lookup(std::string_view series, std::string_view field)
+{
+    key_.assign(series);
+    key_.push_back(' ');
+    key_.append(field);
+    auto it = series_.find(key_);
+    if (it != series_.end())
+    {
+        return it->second;
+    }
+    auto metric = npos;
+    if (auto metric_name = name(series, field))
+    {
+        if (auto m = metrics_.find(*metric_name); m != metrics_.end())
+        {
+            metric = m->second;
+        }
+    }
+    series_.emplace(key_, metric);
+    return metric;
+}
+
+std::optional<std::string> Parser::name(std::string_view series, std::string_view field) const
+{
+    std::vector<std::pair<std::string, std::string>> tags;
+    if (openmetrics_)
+    {
+        // name{label="value",...}
+        auto open = series.find('{');
+        auto measurement = series.substr(0, open);
+        if (open != npos)
+        {
+            auto labels = series.substr(open + 1, series.size() - open - 2);
+            std::size_t pos = 0;
+            while (pos < labels.size())
+            {
+                auto equals = labels.find('=', pos);
+                if (equals == npos || equals + 1 >= labels.size() || labels[equals + 1] != '"')
+                {
+                    break;
+                }
+                auto quote = find_unescaped(labels, '"', equals + 2);
+                if (quote == npos)
+                {
+                    break;
+                }
+                tags.emplace_back(std::string(trim(labels.substr(pos, equals - pos))),
+                                  unescape(labels.substr(equals + 2, quote - equals - 2)));
+                pos = quote + 1;
+                if (pos < labels.size() && labels[pos] == ',')
+                {
+                    pos++;
+                }
+            }
+        }
+        return rule_.apply(measurement, field, tags);
+    }
+
+    // measurement,tag=value,...
+    auto comma = find_unescaped(series, ',');
+    auto measurement = unescape(series.substr(0, comma));
+    while (comma != npos)
+    {
+        auto begin = comma + 1;
+        comma = find_unescaped(series, ',', begin);
+        auto tag = series.substr(begin, comma == npos ? npos : comma - begin);
+        auto equals = find_unescaped(tag, '=');
+        if (equals == npos)
+        {
+            continue;
+        }
+        tags.emplace_back(unescape(tag.substr(0, equals)), unescape(tag.substr(equals + 1)));
+    }
+    return rule_.apply(measurement, unescape(field), tags);
+}
+
+void Parser::influx(std::string_view line)
+{
+    // measurement,tags fields timestamp
+    auto series_end = find_unescaped(line, ' ');
+    if (series_end == npos)
+    {
+        throw std::runtime_error("invalid line: " + std::string(line));
+    }
+    auto series = line.substr(0, series_end);
+    auto fields_end = find_unquoted(line, ' ', series_end + 1);
+    auto fields = line.substr(series_end + 1,
+                              fields_end == npos ? npos : fields_end - series_end - 1);
+    auto timestamp = fields_end == npos ? std::string_view() : trim(line.substr(fields_end + 1));
+    if (timestamp.empty())
+    {
+        // the server time of the export is not known
+        throw std::runtime_error("line without timestamp: " + std::string(line));
+    }
+    auto time = parse_time(timestamp, precision_);
+
+    std::size_t begin = 0;
+    while (begin < fields.size())
+    {
+        auto end = find_unquoted(fields, ',', begin);
+        auto field = fields.substr(begin, end == npos ? npos : end - begin);
+        begin = end == npos ? fields.size() : end + 1;
+
+        auto equals = find_unescaped(field, '=');
+        if (equals == npos || equals + 1 == field.size())
+        {
+            throw std::runtime_error("invalid field in line: " + std::string(line));
+        }
+        auto metric = lookup(series, field.substr(0, equals));
+        if (metric == npos)
+        {
+            unmapped_values_++;
+            continue;
+        }
+
+        auto text = field.substr(equals + 1);
+        double value;
+        auto last = text.back();
+        if (text[0] == '"' || text[0] == 't' || text[0] == 'T' || text[0] == 'f' ||
+            text[0] == 'F')
+        {
+            // strings and booleans
+            skipped_values_++;
+            continue;
+        }
+        else if (last == 'i' || last == 'u')
+        {
+            int64_t integer;
+            auto end = text.data() + text.size() - 1;
+            auto parsed = std::from_chars(text.data(), end, integer);
+            if (parsed.ec != std::errc() || parsed.ptr != end)
+            {
+                throw std::runtime_error("invalid integer in line: " + std::string(line));
+            }
+            value = static_cast<double>(integer);
+        }
+        else
+        {
+            // followed by a separator or the end of the block, which ends strtod
+            char* end;
+            value = std::strtod(text.data(), &end);
+            if (end != text.data() + text.size())
+            {
+                throw std::runtime_error("invalid value in line: " + std::string(line));
+            }
+        }
+        if (!std::isfinite(value))
+        {
+            skipped_values_++;
+            continue;
+        }
+        on_value_(metric, { time, value });
+    }
+}
+
+void Parser::openmetrics(std::string_view line)
+{
+    // name{labels} value [timestamp] [# exemplar]
+    auto name_end = line.find_first_of("{ ");
+    if (name_end == npos)
+    {
+        throw std::runtime_error("invalid line: " + std::string(line));
+    }
+    auto series_end = name_end;
+    if (line[name_end] == '{')
+    {
+        series_end = find_unquoted(line, '}', name_end);
+        if (series_end == npos)
+        {
+            throw std::runtime_error("unterminated labels in line: " + std::string(line));
+        }
+        series_end++;
+    }
+    auto series = line.substr(0, series_end);
+    auto rest = trim(line.substr(series_end));
+    auto value_end = rest.find(' ');
+    auto text = rest.substr(0, value_end);
+    auto timestamp =
+        value_end == npos ? std::string_view() : trim(rest.substr(value_end + 1));
+    timestamp = timestamp.substr(0, timestamp.find(' '));
+    if (timestamp.empty() || timestamp[0] == '#')
+    {
+        throw std::runtime_error("line without timestamp: " + std::string(line));
+    }
+
+    auto metric = lookup(series, "value");
+    if (metric == npos)
+    {
+        unmapped_values_++;
+        return;
+    }
+    char* end;
+    auto value = std::strtod(text.data(), &end);
+    if (text.empty() || end != text.data() + text.size())
+    {
+        throw std::runtime_error("invalid value in line: " + std::string(line));
+    }
+    if (!std::isfinite(value))
+    {
+        skipped_values_++;
+        return;
+    }
+    on_value_(metric, { parse_time(timestamp, precision_), value });
+}
+
+std::vector<import_report> import(nlohmann::json config, const options& options,
+                                  const shard_options& shard_options, Status& status)
+{
+    auto begin_time = std::chrono::steady_clock::now();
+    std::vector<std::string> metric_names;
+    std::unordered_map<std::string, std::size_t> metrics;
+    for (const auto& metric_config : config["metrics"])
+    {
+        metrics.emplace(metric_config["name"], metric_names.size());
+        metric_names.push_back(metric_config["name"]);
+    }
+    auto parser_config = config.value("line_protocol", nlohmann::json::object());
+
+    auto threads = options.threads;
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Pass 1 over the files: the blocks are parsed in parallel, each thread demultiplexes its
+    // values into its own buffers and spills them as sorted runs, so there are no shared locks.
+    status.set_metric("lines", "");
+    status.set_phase("parse");
+    std::vector<std::unique_ptr<SpillBuffer>> buffers;
+    std::vector<std::unique_ptr<Parser>> parsers;
+    for (std::size_t i = 0; i < threads; i++)
+    {
+        buffers.push_back(std::make_unique<SpillBuffer>(metric_names.size(),
+                                                        options.memory / threads,
+                                                        options.spill_directory));
+        auto* buffer = buffers.back().get();
+        parsers.push_back(std::make_unique<Parser>(
+            parser_config, metrics,
+            [buffer](std::size_t metric, point value) { buffer->add(metric, value); }));
+    }
+
+    BlockingQueue<std::string> blocks(2 * threads);
+    std::vector<std::exception_ptr> errors(threads);
+    std::vector<std::thread> parser_threads;
+    for (std::size_t i = 0; i < threads; i++)
+    {
+        parser_threads.emplace_back([&, i]() {
+            try
+            {
+                while (auto block = blocks.pop())
+                {
+                    parsers[i]->feed(*block);
+                }
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+                // unblocks the reader, which then stops
+                blocks.close();
+            }
+        });
+    }
+
+    uint64_t bytes_read = 0;
+    std::exception_ptr read_error;
+    try
+    {
+        for (const auto& file : options.files)
+        {
+            std::cout << "[lines] reading " << file << std::endl;
+            uring::FileReader reader(file, read_block_size, 4, options.drop_cache);
+            // a block ends with a complete line, the rest is carried over to the next one
+            std::string carry;
+            bool open = true;
+            for (auto data = reader.next(); !data.empty() && open; data = reader.next())
+            {
+                bytes_read += data.size();
+                auto last_line = data.rfind('\n');
+                if (last_line == npos)
+                {
+                    carry.append(data);
+                    continue;
+                }
+                std::string block = std::move(carry);
+                block.append(data.substr(0, last_line + 1));
+                carry.assign(data.substr(last_line + 1));
+                open = blocks.push(std::move(block)) && !stop(options);
+            }
+            if (open && !carry.empty())
+            {
+                open = blocks.push(std::move(carry));
+            }
+            if (!open)
+            {
+                break;
+            }
+        }
+    }
+    catch (...)
+    {
+        read_error = std::current_exception();
+    }
+    blocks.close();
+    for (auto& thread : parser_threads)
+    {
+        thread.join();
+    }
+    if (read_error)
+    {
+        std::rethrow_exception(read_error);
+    }
+    for (const auto& error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+    if (stop(options))
+    {
+        throw std::runtime_error("Import stopped.");
+    }
+
+    uint64_t lines = 0, unmapped = 0, skipped = 0, spilled = 0;
+    std::size_t held = 0;
+    for (std::size_t i = 0; i < threads; i++)
+    {
+        lines += parsers[i]->lines();
+        unmapped += parsers[i]->unmapped_values();
+        skipped += parsers[i]->skipped_values();
+        spilled += buffers[i]->spilled_bytes();
+        held += buffers[i]->held_bytes();
+        buffers[i]->sort();
+    }
+    std::cout << "[lines] parsed " << lines << " lines, " << unmapped
+              << " values of unmapped series, " << skipped << " non-numeric values, spilled "
+              << spilled << " bytes" << std::endl;
+
+    // Pass 2 over the sorted runs: each metric is merged from the runs of all threads and
+    // written in timestamp order
+    status.set_phase("merge");
+    std::vector<import_report> reports(metric_names.size());
+    std::vector<std::size_t> with_values;
+    for (std::size_t metric = 0; metric < metric_names.size(); metric++)
+    {
+        for (const auto& buffer : buffers)
+        {
+            if (!buffer->buffer(metric).empty() || !buffer->runs(metric).empty())
+            {
+                with_values.push_back(metric);
+                break;
+            }
+        }
+    }
+
+    auto shards = shard_options.shards;
+    if (shards == 0)
+    {
+        shards = std::max(1u, std::thread::hardware_concurrency());
+    }
+    auto producers = std::max<std::size_t>(1, std::min(threads, with_values.size()));
+    ShardedWriter writer(config, metric_names, shards, producers, shard_options.queue_capacity,
+                         shard_options.max_open_metrics);
+    std::cout << "[lines] writing " << with_values.size() << " metrics into " << shards
+              << " writer shards" << std::endl;
+    // The read windows of the runs get what the values held since pass 1 leave of the memory,
+    // split between the producers, so it stays bounded however many runs the spills produced.
+    auto read_memory = (options.memory > held ? options.memory - held : 0) / producers;
+
+    std::atomic<std::size_t> next_metric{ 0 };
+    std::vector<std::thread> merge_threads;
+    for (std::size_t producer = 0; producer < producers; producer++)
+    {
+        merge_threads.emplace_back([&, producer]() {
+            struct close_producer
+            {
+                ShardedWriter& writer;
+                std::size_t producer;
+                ~close_producer()
+                {
+                    writer.close(producer);
+                }
+            } close_guard{ writer, producer };
+
+            std::size_t next;
+            while ((next = next_metric++) < with_values.size() && !stop(options))
+            {
+                auto metric = with_values[next];
+                auto& report = reports[metric];
+                report.metric = metric_names[metric];
+                report.query_mode = "lines";
+                try
+                {
+                    for (const auto& buffer : buffers)
+                    {
+                        report.spilled_runs += buffer->runs(metric).size();
+                    }
+                    std::size_t read_size = max_spill_read_size;
+                    if (report.spilled_runs > 0)
+                    {
+                        read_size = std::clamp<std::size_t>(
+                            read_memory / sizeof(point) / report.spilled_runs,
+                            min_spill_read_size, max_spill_read_size);
+                    }
+                    std::vector<Cursor> cursors;
+                    for (const auto& buffer : buffers)
+                    {
+                        for (const auto& run : buffer->runs(metric))
+                        {
+                            cursors.emplace_back(buffer->fd(), run, read_size);
+                        }
+                        if (!buffer->buffer(metric).empty())
+                        {
+                            cursors.emplace_back(buffer->buffer(metric));
+                        }
+                    }
+                    auto later = [&cursors](std::size_t a, std::size_t b) {
+                        return cursors[b].current().time < cursors[a].current().time;
+                    };
+                    std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)>
+                        heap(later);
+                    for (std::size_t i = 0; i < cursors.size(); i++)
+                    {
+                        heap.push(i);
+                    }
+
+                    std::optional<profile::Profile> profile;
+                    if (options.profile)
+                    {
+                        profile.emplace();
+                    }
+                    auto batch = std::make_shared<Batch>();
+                    hta::TimePoint previous;
+                    // the rows are published per batch, the producers would contend per row
+                    uint64_t published_rows = 0;
+                    int64_t last_time = 0;
+                    auto publish = [&]() {
+                        status.rows(report.rows - published_rows, last_time / 1000000);
+                        published_rows = report.rows;
+                    };
+                    while (!heap.empty())
+                    {
+                        auto i = heap.top();
+                        heap.pop();
+                        auto value = cursors[i].current();
+                        cursors[i].advance();
+                        if (!cursors[i].done())
+                        {
+                            heap.push(i);
+                        }
+
+                        hta::TimePoint time{ hta::duration_cast(
+                            std::chrono::nanoseconds(value.time)) };
+                        report.rows++;
+                        last_time = value.time;
+                        if (time <= previous)
+                        {
+                            // duplicates, e.g. from overlapping exports
+                            continue;
+                        }
+                        if (value.value > 1e12 || value.value < -1e12)
+                        {
+                            // Unlike a single import, which fails on the first one, the value is
+                            // skipped, as in the fleet sync: the files mix many series, and one
+                            // broken series must not fail the others.
+                            report.extreme_values++;
+                            continue;
+                        }
+                        previous = time;
+                        batch->values.push_back({ time, value.value });
+                        if (profile)
+                        {
+                            profile->add(batch->values.back());
+                        }
+                        if (batch->values.size() >= batch_size)
+                        {
+                            publish();
+                            writer.push(producer, metric, std::move(batch));
+                            batch = std::make_shared<Batch>();
+                        }
+                    }
+                    publish();
+                    if (!batch->values.empty())
+                    {
+                        writer.push(producer, metric, std::move(batch));
+                    }
+                    if (report.extreme_values)
+                    {
+                        std::cerr << "[" << report.metric << "] skipped " << report.extreme_values
+                                  << " extreme values" << std::endl;
+                    }
+                    if (profile)
+                    {
+                        report.profile = profile->to_json();
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "[" << report.metric << "] error: " << e.what() << std::endl;
+                    report.error = e.what();
+                }
+            }
+        });
+    }
+    for (auto& thread : merge_threads)
+    {
+        thread.join();
+    }
+    status.set_phase("finish");
+    auto write_errors = writer.finish();
+    for (auto metric : with_values)
+    {
+        if (!write_errors[metric].empty())
+        {
+            reports[metric].error = write_errors[metric];
+        }
+    }
+    if (stop(options))
+    {
+        throw std::runtime_error("Import stopped.");
+    }
+
+    auto wall_time =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_time).count();
+    std::vector<import_report> result;
+    for (auto metric : with_values)
+    {
+        reports[metric].wall_time = wall_time;
+        result.push_back(std::move(reports[metric]));
+    }
+    if (!result.empty())
+    {
+        // the files are shared by all metrics, the first report carries them
+        result.front().bytes_read = bytes_read;
+    }
+    return result;
+}
+} // namespace lines
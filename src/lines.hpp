@@ -0,0 +1,165 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "import.hpp"
+#include "report.hpp"
+#include "status.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+// Source for text exports that mix many series in one file, in InfluxDB line protocol or in the
+// OpenMetrics / Prometheus text format. The series are mapped to metrics of the config and
+// demultiplexed into one sorted stream per metric.
+namespace lines
+{
+struct point
+{
+    // nanoseconds since the epoch
+    int64_t time;
+    double value;
+};
+
+// Maps a series to a metric name, e.g. "{measurement}.{host}.{field}". measurement is the
+// measurement or metric family, field the field key ("value" for OpenMetrics), all other
+// placeholders are tags or labels.
+class Rule
+{
+public:
+    explicit Rule(const std::string& pattern);
+
+    // nothing if the series lacks one of the tags
+    std::optional<std::string>
+    apply(std::string_view measurement, std::string_view field,
+          const std::vector<std::pair<std::string, std::string>>& tags) const;
+
+private:
+    struct part
+    {
+        bool placeholder;
+        std::string text;
+    };
+    std::vector<part> parts_;
+};
+
+// Parses blocks of complete lines and passes the values of mapped series to the callback.
+// The mapping is cached per series key, so the rule only runs for new series.
+class Parser
+{
+public:
+    using callback = std::function<void(std::size_t metric, point value)>;
+
+    // config is the "line_protocol" section, metrics maps the metric names to their index
+    Parser(const nlohmann::json& config,
+           const std::unordered_map<std::string, std::size_t>& metrics, callback on_value);
+
+    void feed(std::string_view block);
+
+    uint64_t lines() const
+    {
+        return lines_;
+    }
+
+    // values of series that do not map to a configured metric
+    uint64_t unmapped_values() const
+    {
+        return unmapped_values_;
+    }
+
+    // string, boolean and non-finite values
+    uint64_t skipped_values() const
+    {
+        return skipped_values_;
+    }
+
+    std::size_t series() const
+    {
+        return series_.size();
+    }
+
+private:
+    void influx(std::string_view line);
+    void openmetrics(std::string_view line);
+    // index of the metric of the series, npos if it is not mapped
+    std::size_t lookup(std::string_view series, std::string_view field);
+    // runs the rule on the unescaped series key
+    std::optional<std::string> name(std::string_view series, std::string_view field) const;
+
+    bool openmetrics_;
+    // nanoseconds per timestamp unit
+    int64_t precision_;
+    Rule rule_;
+    const std::unordered_map<std::string, std::size_t>& metrics_;
+    callback on_value_;
+
+    // series key -> metric index or npos
+    std::unordered_map<std::string, std::size_t> series_;
+    std::string key_;
+
+    uint64_t lines_ = 0;
+    uint64_t unmapped_values_ = 0;
+    uint64_t skipped_values_ = 0;
+};
+
+struct options
+{
+    std::vector<std::string> files;
+    // parser threads, 0 for one per hardware thread
+    std::size_t threads = 0;
+    // bytes of values held in memory over all parser threads, sorted runs are spilled beyond
+    std::size_t memory = std::size_t(1) << 30;
+    // directory for the spill files, empty for the temporary directory
+    std::string spill_directory;
+    bool drop_cache = false;
+    // profile the values of each metric into its report while merging
+    bool profile = false;
+    const std::atomic<bool>* stop_requested = nullptr;
+};
+
+// Imports all values of the files in one pass over them into the metrics of the config, writing
+// through a ShardedWriter. The mapping is configured by the "line_protocol" section of the
+// config: "format" ("influx" or "openmetrics"), "precision" of the timestamps ("ns", "us", "ms",
+// "s") and the "name" rule. Returns one report per metric with values.
+std::vector<import_report> import(nlohmann::json config, const options& options,
+                                  const shard_options& shard_options, Status& status);
+} // namespace lines
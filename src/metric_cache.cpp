@@ -0,0 +1,143 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "metric_cache.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+extern "C"
+{
+#include <sys/resource.h>
+}
+
+namespace
+{
+// file descriptors kept free for connections, sockets and the rest of the process
+constexpr std::size_t reserved_fds = 64;
+
+// one file for the raw values and one per aggregation level
+std::size_t files_per_metric(const nlohmann::json& metric_config)
+{
+    auto interval_min = metric_config.value("interval_min", uint64_t(0));
+    auto interval_max = metric_config.value("interval_max", uint64_t(0));
+    auto interval_factor = metric_config.value("interval_factor", uint64_t(0));
+    if (interval_min == 0 || interval_factor < 2)
+    {
+        // unknown, assume a deep hierarchy
+        return 16;
+    }
+    std::size_t files = 1;
+    for (auto interval = interval_min; interval <= interval_max; interval *= interval_factor)
+    {
+        files++;
+    }
+    return files;
+}
+} // namespace
+
+MetricCache::MetricCache(const nlohmann::json& config, std::size_t capacity, std::size_t share)
+: base_config_(config), capacity_(capacity)
+{
+    base_config_["metrics"] = nlohmann::json::array();
+
+    std::size_t max_files = 1;
+    for (const auto& metric_config : config["metrics"])
+    {
+        metric_configs_.emplace(metric_config["name"].get<std::string>(), metric_config);
+        max_files = std::max(max_files, files_per_metric(metric_config));
+    }
+
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    {
+        auto fds = limit.rlim_cur > reserved_fds ? limit.rlim_cur - reserved_fds : 0;
+        std::size_t fd_capacity = fds / max_files / std::max<std::size_t>(share, 1);
+        capacity_ = capacity_ ? std::min(capacity_, fd_capacity) : fd_capacity;
+    }
+    else if (!capacity_)
+    {
+        capacity_ = 1024;
+    }
+    capacity_ = std::max<std::size_t>(capacity_, 1);
+}
+
+MetricCache::~MetricCache()
+{
+    try
+    {
+        flush();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "failed to flush metrics: " << e.what() << std::endl;
+    }
+}
+
+hta::Metric& MetricCache::get(const std::string& name)
+{
+    auto it = open_.find(name);
+    if (it != open_.end())
+    {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return *it->second.metric;
+    }
+
+    auto config = base_config_;
+    config["metrics"].push_back(metric_configs_.at(name));
+    while (open_.size() >= capacity_)
+    {
+        evict();
+    }
+
+    auto directory = std::make_unique<hta::Directory>(config);
+    auto* metric = &(*directory)[name];
+    lru_.push_front(name);
+    open_.emplace(name, entry{ std::move(directory), metric, lru_.begin() });
+    return *metric;
+}
+
+void MetricCache::evict()
+{
+    auto it = open_.find(lru_.back());
+    it->second.metric->flush();
+    open_.erase(it);
+    lru_.pop_back();
+    evictions_++;
+}
+
+void MetricCache::flush()
+{
+    for (auto& [name, e] : open_)
+    {
+        e.metric->flush();
+    }
+}
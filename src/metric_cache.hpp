@@ -0,0 +1,93 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <hta/hta.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <cstdint>
+
+// Opens the metrics of a possibly huge config lazily, each in its own hta::Directory reduced to
+// that metric, and closes the least recently used ones to keep the number of open metrics, and
+// with it file descriptors and buffers, bounded. Not thread-safe, each thread needs its own.
+class MetricCache
+{
+public:
+    // capacity 0 derives the capacity from the file descriptor limit of the process, divided by
+    // share for caches that coexist in one process
+    explicit MetricCache(const nlohmann::json& config, std::size_t capacity = 0,
+                         std::size_t share = 1);
+    ~MetricCache();
+
+    MetricCache(const MetricCache&) = delete;
+    MetricCache& operator=(const MetricCache&) = delete;
+
+    // Opens the metric if necessary, which may close others. The reference is valid until the
+    // next call. Throws std::out_of_range for metrics that are not in the config.
+    hta::Metric& get(const std::string& name);
+
+    // flushes all open metrics, closed ones were flushed when they were closed
+    void flush();
+
+    std::size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    uint64_t evictions() const
+    {
+        return evictions_;
+    }
+
+private:
+    struct entry
+    {
+        std::unique_ptr<hta::Directory> directory;
+        hta::Metric* metric;
+        std::list<std::string>::iterator lru;
+    };
+
+    void evict();
+
+    nlohmann::json base_config_;
+    std::unordered_map<std::string, nlohmann::json> metric_configs_;
+    std::size_t capacity_;
+    // most recently used first
+    std::list<std::string> lru_;
+    std::unordered_map<std::string, entry> open_;
+    uint64_t evictions_ = 0;
+};
@@ -28,30 +28,22 @@
 // NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
-#include <hta/hta.hpp>
-#include <hta/ostream.hpp>
+#include "alloc_stats.hpp"
+#include "binlog.hpp"
+#include "import.hpp"
+#include "lines.hpp"
+#include "report.hpp"
+#include "status.hpp"
 
 #include <nlohmann/json.hpp>
 
-#include <cppconn/prepared_statement.h>
-#include <cppconn/resultset.h>
-#include <cppconn/statement.h>
-
-// The header uses removed exception specification... so we must use this ugly workaround
-#define throw(...)
-#include <mysql_driver.h>
-#undef throw
-
 #include <boost/program_options.hpp>
-#include <boost/timer/timer.hpp>
 
+#include <atomic>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 
-#include <cassert>
-#include <cmath>
-
 extern "C"
 {
 #include <signal.h>
@@ -60,12 +52,19 @@ extern "C"
 namespace po = boost::program_options;
 using json = nlohmann::json;
 
-volatile sig_atomic_t stop_requested = 0;
+std::atomic<bool> stop_requested{ false };
+std::atomic<bool> pause_requested{ false };
 
 void handle_signal(int)
 {
     std::cerr << "caught sigint, requesting stop." << std::endl;
-    stop_requested = 1;
+    stop_requested = true;
+}
+
+// SIGUSR1 pauses the import at the next chunk boundary, SIGUSR2 resumes it
+void handle_pause_signal(int signal)
+{
+    pause_requested = (signal == SIGUSR1);
 }
 
 json read_json_from_file(const std::filesystem::path& path)
@@ -78,144 +77,275 @@ json read_json_from_file(const std::filesystem::path& path)
     return config;
 }
 
-struct stats
+int main(int argc, char* argv[])
 {
-    uint64_t min_timestamp;
-    uint64_t max_timestamp;
-    uint64_t count;
-};
+    std::string config_file = "config.json";
+    import_options options;
+    std::string report_file;
+    std::string profile_file;
+    std::string status_socket;
+    std::vector<std::string> output_config_files;
+    binlog::options binlog_options;
+    fleet::options sync_options;
+    shard_options multi_options;
+    lines::options lines_options;
+    std::size_t lines_memory_mib = lines_options.memory >> 20;
+    std::size_t max_open_metrics = 0;
+    std::string binlog_start;
+
+    // installed first, before the import announces that it is ready for them
+    signal(SIGUSR1, handle_pause_signal);
+    signal(SIGUSR2, handle_pause_signal);
 
-stats stats_query(sql::Connection& db, const std::string metric)
-{
-    auto query =
-        std::string("SELECT COUNT(`timestamp`), MIN(`timestamp`), MAX(`timestamp`) FROM ") + metric;
-    auto stmt = std::unique_ptr<sql::PreparedStatement>(db.prepareStatement(query));
-    auto result = std::unique_ptr<sql::ResultSet>(stmt->executeQuery());
-    assert(result->next());
-    stats ret;
-    ret.count = result->getUInt64(1);
-    ret.min_timestamp = result->getUInt64(2);
-    ret.max_timestamp = result->getUInt64(3);
-    return ret;
-}
+    po::options_description desc("Import dataheap database into HTA");
 
-void import(sql::Connection& in_db, hta::Directory& out_directory,
-            const std::string& in_metric_name, const std::string& out_metric_name,
-            uint64_t min_timestamp, uint64_t max_timestamp, uint64_t max_limit)
-{
-    boost::timer::cpu_timer timer;
+    // clang-format off
+    desc.add_options()(
+        "help", "produce help message")(
+        "config,c", po::value(&config_file), "path to config file (default \"config.json\").")(
+        "output-config,o", po::value(&output_config_files)->composing(),
+            "path to the config of an additional output directory, can be repeated")(
+        "arrow-output", po::value(&options.arrow_output),
+            "also write the values as Arrow IPC files into this directory")(
+        "metric,m", po::value<std::string>(), "name of metric")(
+        "import-metric", po::value<std::string>(), "import name of metric")(
+        "mysql-chunk-size", po::value(&options.chunk_size), "the chunksize for mysql streaming")(
+        "packed-rows", po::value(&options.packed_rows),
+            "let the server pack about this many values into one result row (default 0: off)")(
+        "hedge-percentile", po::value(&options.hedge_percentile),
+            "reissue chunk queries slower than this percentile (e.g. 0.95) on a second connection")(
+        "dump", po::value(&options.dump_directory),
+            "read the metric from this MySQL Shell dump directory instead of the server")(
+        "dump-threads", po::value(&options.dump_threads),
+            "threads decompressing dump chunks (default: one per hardware thread)")(
+        "min-timestamp", po::value(&options.min_timestamp),
+            "minimal timestamp for dump, in unix-ms")(
+        "max-timestamp", po::value(&options.max_timestamp),
+            "maximal timestamp for dump, in unix-ms")(
+        "alloc-stats", po::bool_switch(&options.report_allocations),
+            "report heap allocations per chunk and phase (requires HTA_IMPORT_ALLOC_STATS build)")(
+        "report", po::value(&report_file),
+            "write the resource usage of the import as JSON to this file")(
+        "profile", po::value(&profile_file),
+            "profile values, intervals and gaps during the import and write them to this file")(
+        "status-socket", po::value(&status_socket),
+            "serve the live state of the import as JSON on this Unix socket")(
+        "durable", po::bool_switch(&options.durable),
+            "fdatasync the output after every chunk, in the background on io_uring if available")(
+        "drop-cache", po::bool_switch(&options.drop_cache),
+            "drop the output from the page cache once it is durable, implies --durable")(
+        "numa", po::bool_switch(&options.numa),
+            "pin the threads of each import to the CPUs of one NUMA node")(
+        "nic", po::value(&options.nic),
+            "network interface of the source connection, with --numa its node is used")(
+        "pipeline", po::value(&options.pipeline),
+            "with --numa: index of this import among the ones running in parallel, "
+            "spreads them round-robin over the nodes")(
+        "max-open-metrics", po::value(&max_open_metrics),
+            "metrics kept open at a time in the modes that write many metrics "
+            "(default: as many as the file descriptor limit allows)");
+
+    po::options_description binlog_desc("Binlog follow mode");
+    binlog_desc.add_options()(
+        "follow-binlog", "append inserts from the binlog to all configured metrics")(
+        "binlog-file", po::value(&binlog_options.files)->composing(),
+            "read this binlog file instead of following the server, can be repeated")(
+        "binlog-start", po::value(&binlog_start),
+            "binlog FILE:POSITION to start following the server from, if there is no state")(
+        "binlog-state", po::value(&binlog_options.state_file),
+            "file to store the binlog position of the last checkpoint in and resume from")(
+        "mysqlbinlog", po::value(&binlog_options.mysqlbinlog),
+            "mysqlbinlog executable (default \"mysqlbinlog\")")(
+        "flush-interval", po::value(&binlog_options.flush_interval),
+            "seconds between flushes and checkpoints (default 1)");
+
+    po::options_description sync_desc("Fleet sync mode");
+    sync_desc.add_options()(
+        "sync", "keep all configured metrics in sync by polling for new rows")(
+        "sync-tables-per-query", po::value(&sync_options.tables_per_query),
+            "tables combined into one poll query (default 100)")(
+        "sync-queries-per-second", po::value(&sync_options.queries_per_second),
+            "maximum poll queries per second (default 2)")(
+        "sync-row-limit", po::value(&sync_options.row_limit),
+            "maximum rows per table and poll (default 100000)")(
+        "sync-min-interval", po::value(&sync_options.min_interval),
+            "minimum poll interval per table in seconds (default 10)")(
+        "sync-max-interval", po::value(&sync_options.max_interval),
+            "maximum poll interval per table in seconds (default 3600)");
+
+    po::options_description multi_desc("Multi-metric mode");
+    multi_desc.add_options()(
+        "all-metrics", "import all metrics of the config in one process")(
+        "connections", po::value(&multi_options.connections),
+            "source connections, each importing one metric at a time (default 4)")(
+        "shards", po::value(&multi_options.shards),
+            "writer threads that own the metrics (default: one per hardware thread)");
+
+    po::options_description lines_desc("Line protocol mode");
+    lines_desc.add_options()(
+        "lines", po::value(&lines_options.files)->composing(),
+            "import the series of this line protocol or OpenMetrics file, can be repeated")(
+        "lines-threads", po::value(&lines_options.threads),
+            "threads parsing the files (default: one per hardware thread)")(
+        "lines-memory", po::value(&lines_memory_mib),
+            "MiB of values held in memory before sorted runs are spilled to disk (default 1024)")(
+        "spill-directory", po::value(&lines_options.spill_directory),
+            "directory for the spill files (default: the temporary directory)");
+    // clang-format on
+    desc.add(binlog_desc);
+    desc.add(sync_desc);
+    desc.add(multi_desc);
+    desc.add(lines_desc);
 
-    auto stats = stats_query(in_db, in_metric_name);
-    auto& out_metric = out_directory[out_metric_name];
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
 
-    uint64_t row = 0;
-    hta::TimePoint previous_time;
-    uint64_t current_dataheap_timestamp;
+    if (vm.count("help"))
+    {
+        std::cout << desc << "\n";
+        return 0;
+    };
 
-    std::string query = std::string("SELECT timestamp, value FROM ") + in_metric_name +
-                        " WHERE timestamp >= ? AND timestamp < ?" +
-                        " ORDER BY timestamp ASC LIMIT ?";
+    if (options.hedge_percentile < 0 || options.hedge_percentile >= 1)
+    {
+        std::cerr << "Error: --hedge-percentile must be in (0, 1), e.g. 0.95\n";
+        return 1;
+    }
 
-    std::unique_ptr<sql::PreparedStatement> stmt(in_db.prepareStatement(query));
+    options.profile = !profile_file.empty();
+    binlog_options.max_open_metrics = max_open_metrics;
+    sync_options.max_open_metrics = max_open_metrics;
+    multi_options.max_open_metrics = max_open_metrics;
 
-    min_timestamp = std::max(min_timestamp, stats.min_timestamp);
-    if (max_timestamp)
+    Status status;
+    std::unique_ptr<StatusServer> status_server;
+    if (!status_socket.empty())
     {
-        max_timestamp = std::min(max_timestamp, stats.max_timestamp + 1);
+        status_server = std::make_unique<StatusServer>(status, status_socket);
     }
-    else
+
+    if (vm.count("follow-binlog"))
     {
-        max_timestamp = stats.max_timestamp + 1;
+        if (auto colon = binlog_start.rfind(':'); colon != std::string::npos)
+        {
+            binlog_options.start_file = binlog_start.substr(0, colon);
+            binlog_options.start_position = std::stoull(binlog_start.substr(colon + 1));
+        }
+        binlog_options.stop_requested = &stop_requested;
+        signal(SIGINT, handle_signal);
+        try
+        {
+            binlog::follow(read_json_from_file(config_file), binlog_options, status);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "error: " << e.what();
+            return -1;
+        }
+        return 0;
     }
 
-    auto sampling_interval =
-        static_cast<double>(stats.max_timestamp - stats.min_timestamp) / stats.count;
-    uint64_t chunk_timedelta =
-        sampling_interval * max_limit / 2; // Use 1/2 to not run into limit too often
-
-    std::cout << "[" << out_metric_name << "] starting import from " << in_metric_name
-              << " using a chunk time of " << chunk_timedelta << std::endl;
-
-    auto current_timestamp = min_timestamp;
-    while (true)
+    if (vm.count("sync"))
     {
-        if (current_timestamp >= max_timestamp)
+        sync_options.stop_requested = &stop_requested;
+        signal(SIGINT, handle_signal);
+        try
         {
-            std::cout << "[" << out_metric_name << "] completed import of " << row << " rows\n";
-            std::cout << timer.format() << std::endl;
-            return;
+            Engine engine;
+            engine.sync(read_json_from_file(config_file), sync_options, status);
         }
-
-        uint64_t next_timestamp = std::min(current_timestamp + chunk_timedelta, max_timestamp);
-
-        stmt->setUInt64(1, current_timestamp);
-        stmt->setUInt64(2, next_timestamp);
-        stmt->setUInt64(3, max_limit);
-
-        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
-
-        if (res->rowsCount() == 0)
+        catch (const std::exception& e)
         {
-            current_timestamp = next_timestamp;
-            continue;
+            std::cerr << "error: " << e.what();
+            return -1;
         }
-        while (res->next())
+        return 0;
+    }
+
+    // the modes importing many metrics write one report per metric
+    auto write_reports = [&report_file, &profile_file](const std::vector<import_report>& reports) {
+        auto reports_json = json::array();
+        auto profiles = json::object();
+        int failed = 0;
+        for (const auto& report : reports)
         {
-            current_dataheap_timestamp = res->getUInt64(1);
-            row++;
-            hta::TimePoint hta_time{ hta::duration_cast(
-                std::chrono::milliseconds(current_dataheap_timestamp)) };
-            if (hta_time <= previous_time)
+            reports_json.push_back(report.to_json());
+            failed += !report.error.empty();
+            if (!report.profile.is_null())
             {
-                std::cout << "Skipping non-monotonous timestamp " << hta_time << std::endl;
-                continue;
+                profiles[report.metric] = report.profile;
             }
-            previous_time = hta_time;
-            auto value = static_cast<double>(res->getDouble(2));
-            if (value > 1e12 || value < -1e12)
+        }
+        if (!report_file.empty())
+        {
+            std::ofstream report_stream(report_file);
+            report_stream << reports_json.dump(2) << std::endl;
+        }
+        if (!profile_file.empty())
+        {
+            std::ofstream profile_stream(profile_file);
+            profile_stream << profiles.dump(2) << std::endl;
+        }
+        if (failed)
+        {
+            std::cerr << failed << " of " << reports.size() << " imports failed" << std::endl;
+            return -1;
+        }
+        return 0;
+    };
+
+    if (vm.count("all-metrics"))
+    {
+        // the shards write plain hta::Directory instances, and the connections import one
+        // metric after another without a second connection
+        for (auto unsupported : { "durable", "drop-cache", "output-config", "arrow-output", "dump",
+                                  "hedge-percentile" })
+        {
+            if (vm.count(unsupported) && !vm[unsupported].defaulted())
             {
-                std::cerr << "[" << out_metric_name << "] extreme value " << value << std::endl;
-                throw std::runtime_error("Value exceeds expectation.");
+                std::cerr << "Error: --" << unsupported << " is not supported with --all-metrics\n";
+                return 1;
             }
-            out_metric.insert({ hta_time, value });
         }
-
-        out_metric.flush();
-        std::cout << "[" << out_metric_name << "] " << row << " rows completed." << std::endl;
-
-        current_timestamp = current_dataheap_timestamp + 1;
+        options.stop_requested = &stop_requested;
+        options.pause_requested = &pause_requested;
+        signal(SIGINT, handle_signal);
+        std::vector<import_report> reports;
+        try
+        {
+            Engine engine;
+            reports = engine.run_sharded(read_json_from_file(config_file), options,
+                                         multi_options, status);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "error: " << e.what();
+            return -1;
+        }
+        return write_reports(reports);
     }
-}
 
-int main(int argc, char* argv[])
-{
-    std::string config_file = "config.json";
-    uint64_t min_timestamp = 0;
-    uint64_t max_timestamp = 0;
-    size_t chunk_size = 20000000;
-
-    po::options_description desc("Import dataheap database into HTA");
-
-    // clang-format off
-    desc.add_options()(
-        "help", "produce help message")(
-        "config,c", po::value(&config_file), "path to config file (default \"config.json\").")(
-        "metric,m", po::value<std::string>(), "name of metric")(
-        "import-metric", po::value<std::string>(), "import name of metric")(
-        "mysql-chunk-size", po::value(&chunk_size), "the chunksize for mysql streaming")(
-        "min-timestamp", po::value(&min_timestamp), "minimal timestamp for dump, in unix-ms")(
-        "max-timestamp", po::value(&max_timestamp), "maximal timestamp for dump, in unix-ms");
-    // clang-format on
-
-    po::variables_map vm;
-    po::store(po::parse_command_line(argc, argv, desc), vm);
-    po::notify(vm);
-
-    if (vm.count("help"))
+    if (!lines_options.files.empty())
     {
-        std::cout << desc << "\n";
-        return 0;
-    };
+        lines_options.memory = lines_memory_mib << 20;
+        lines_options.drop_cache = options.drop_cache;
+        lines_options.profile = options.profile;
+        lines_options.stop_requested = &stop_requested;
+        signal(SIGINT, handle_signal);
+        std::vector<import_report> reports;
+        try
+        {
+            reports = lines::import(read_json_from_file(config_file), lines_options,
+                                    multi_options, status);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "error: " << e.what();
+            return -1;
+        }
+        return write_reports(reports);
+    }
 
     if (!vm.count("metric"))
     {
@@ -224,55 +354,69 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    if (options.report_allocations && !alloc_stats::available)
+    {
+        std::cerr << "Error: --alloc-stats requires a build with -DHTA_IMPORT_ALLOC_STATS=ON\n";
+        return 1;
+    }
+
     // for thousands separators
     std::cout.imbue(std::locale(""));
 
-    auto out_metric_name = vm["metric"].as<std::string>();
-    auto in_metric_name = out_metric_name;
+    options.metric = vm["metric"].as<std::string>();
+    options.import_metric = options.metric;
 
     if (vm.count("import-metric"))
     {
-        in_metric_name = vm["import-metric"].as<std::string>();
+        options.import_metric = vm["import-metric"].as<std::string>();
     }
     else
     {
-        std::replace(in_metric_name.begin(), in_metric_name.end(), '.', '_');
+        std::replace(options.import_metric.begin(), options.import_metric.end(), '.', '_');
     }
     // DO NOT do this. There are metrics like foo/bar_baz, which should be foo.bar_baz
     // std::replace(out_metric_name.begin(), out_metric_name.end(), '_', '.');
 
     auto config = read_json_from_file(std::filesystem::path(config_file));
-
-    // setup input / import database
-    sql::Driver* driver = sql::mysql::get_driver_instance();
-    const auto& conf_import = config["import"];
-    std::string host = conf_import["host"];
-    std::string user = conf_import["user"];
-    std::string password = conf_import["password"];
-    std::string schema = conf_import["database"];
-    std::unique_ptr<sql::Connection> con(driver->connect(host, user, password));
-    con->setSchema(schema);
-
-    for (auto metric_config : config["metrics"])
+    for (const auto& output_config_file : output_config_files)
     {
-        if (metric_config["name"] == out_metric_name)
-        {
-            config["metrics"] = json::array({ metric_config });
-            break;
-        }
+        options.output_configs.push_back(read_json_from_file(output_config_file));
     }
 
-    hta::Directory out_directory(config);
+    import_report report;
+    report.metric = options.metric;
+    report.import_metric = options.import_metric;
+    auto write_report = [&report, &report_file, &profile_file]() {
+        // the process only ran this import
+        report.peak_rss = process_peak_rss();
+        if (!report_file.empty())
+        {
+            std::ofstream report_stream(report_file);
+            report_stream << report.to_json().dump(2) << std::endl;
+        }
+        if (!profile_file.empty() && !report.profile.is_null())
+        {
+            std::ofstream profile_stream(profile_file);
+            profile_stream << report.profile.dump(2) << std::endl;
+        }
+    };
 
+    options.stop_requested = &stop_requested;
+    options.pause_requested = &pause_requested;
     signal(SIGINT, handle_signal);
+    // the orchestrator only sends SIGUSR1/SIGUSR2 after this line
+    std::cout << "[" << options.metric << "] ready" << std::endl;
     try
     {
-        import(*con, out_directory, in_metric_name, out_metric_name, min_timestamp, max_timestamp,
-               chunk_size);
+        Engine engine;
+        engine.run(config, options, report, status);
     }
     catch (const std::exception& e)
     {
         std::cerr << "error: " << e.what();
+        report.error = e.what();
+        write_report();
         return -1;
     }
+    write_report();
 }
@@ -0,0 +1,196 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "numa.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+extern "C"
+{
+#include <pthread.h>
+}
+
+namespace numa
+{
+namespace
+{
+// parses the kernel's list format, e.g. "0-15,32-47"
+cpu_list parse_cpu_list(const std::string& list)
+{
+    cpu_list cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ','))
+    {
+        if (range.empty())
+        {
+            continue;
+        }
+        auto dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+cpu_set_t to_cpu_set(const cpu_list& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return set;
+}
+} // namespace
+
+std::vector<node> nodes()
+{
+    std::vector<node> result;
+    std::error_code ec;
+    for (const auto& entry :
+         std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+    {
+        auto name = entry.path().filename().string();
+        if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+            !std::all_of(name.begin() + 4, name.end(), ::isdigit))
+        {
+            continue;
+        }
+        std::ifstream cpulist(entry.path() / "cpulist");
+        std::string list;
+        std::getline(cpulist, list);
+        auto cpus = parse_cpu_list(list);
+        if (!cpus.empty())
+        {
+            result.push_back({ std::stoi(name.substr(4)), std::move(cpus) });
+        }
+    }
+    if (result.empty())
+    {
+        cpu_list cpus(std::max(1u, std::thread::hardware_concurrency()));
+        for (std::size_t cpu = 0; cpu < cpus.size(); cpu++)
+        {
+            cpus[cpu] = static_cast<int>(cpu);
+        }
+        result.push_back({ 0, std::move(cpus) });
+    }
+    std::sort(result.begin(), result.end(),
+              [](const node& lhs, const node& rhs) { return lhs.id < rhs.id; });
+    return result;
+}
+
+int interface_node(const std::string& interface)
+{
+    std::ifstream numa_node("/sys/class/net/" + interface + "/device/numa_node");
+    int node = -1;
+    if (!(numa_node >> node))
+    {
+        return -1;
+    }
+    return node;
+}
+
+Placement::Placement(const std::string& interface) : nodes_(nodes())
+{
+    if (interface.empty())
+    {
+        return;
+    }
+    auto id = interface_node(interface);
+    for (std::size_t i = 0; i < nodes_.size(); i++)
+    {
+        if (nodes_[i].id == id)
+        {
+            interface_index_ = static_cast<int>(i);
+        }
+    }
+    if (interface_index_ < 0)
+    {
+        std::cerr << "NUMA node of " << interface << " unknown, spreading over all nodes"
+                  << std::endl;
+    }
+}
+
+std::size_t Placement::node_index(std::size_t n) const
+{
+    return n % nodes_.size();
+}
+
+std::size_t Placement::fetch_node_index(std::size_t n) const
+{
+    // the socket buffers of the network interface are on its node
+    if (interface_index_ >= 0)
+    {
+        return static_cast<std::size_t>(interface_index_);
+    }
+    return node_index(n);
+}
+
+ScopedPin::ScopedPin(const cpu_list& cpus)
+{
+    if (pthread_getaffinity_np(pthread_self(), sizeof(previous_), &previous_) != 0)
+    {
+        return;
+    }
+    auto set = to_cpu_set(cpus);
+    restore_ = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+ScopedPin::~ScopedPin()
+{
+    if (restore_)
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(previous_), &previous_);
+    }
+}
+
+void pin(const cpu_list& cpus)
+{
+    auto set = to_cpu_set(cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    {
+        std::cerr << "failed to set the CPU affinity of a thread" << std::endl;
+    }
+}
+} // namespace numa
@@ -0,0 +1,114 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <sched.h>
+}
+
+// Placement of pipeline stages on NUMA nodes. Threads inherit the CPU affinity of the thread that
+// creates them, so pinning the thread that sets up a pipeline keeps all its stages on one node.
+// Memory is not bound explicitly: the kernel places pages on the node of the thread that first
+// touches them, which for batch buffers is the pinned decode thread.
+namespace numa
+{
+using cpu_list = std::vector<int>;
+
+struct node
+{
+    int id;
+    cpu_list cpus;
+};
+
+// NUMA nodes with CPUs from sysfs, a single node with all CPUs if there is no NUMA information
+std::vector<node> nodes();
+
+// node the network interface is attached to, -1 if unknown
+int interface_node(const std::string& interface);
+
+// Chooses the nodes for pipelines. Pipelines and shards are spread round-robin over all nodes. With
+// a network interface, the stages that fetch and decode the source data prefer its node; the
+// writers of a single import follow them, so that its batches stay on one node.
+class Placement
+{
+public:
+    explicit Placement(const std::string& interface = "");
+
+    std::size_t node_count() const
+    {
+        return nodes_.size();
+    }
+
+    // index into the nodes for the n-th pipeline or stage
+    std::size_t node_index(std::size_t n) const;
+
+    const cpu_list& cpus(std::size_t n) const
+    {
+        return nodes_[node_index(n)].cpus;
+    }
+
+    // as node_index, but for the n-th fetch and decode stage
+    std::size_t fetch_node_index(std::size_t n) const;
+
+    const cpu_list& fetch_cpus(std::size_t n) const
+    {
+        return nodes_[fetch_node_index(n)].cpus;
+    }
+
+private:
+    std::vector<node> nodes_;
+    // index of the node of the network interface, -1 if unknown
+    int interface_index_ = -1;
+};
+
+// Restricts the calling thread, and the threads it creates meanwhile, to the given CPUs.
+// The previous affinity is restored on destruction, as threads of a pool are reused.
+class ScopedPin
+{
+public:
+    explicit ScopedPin(const cpu_list& cpus);
+    ~ScopedPin();
+
+    ScopedPin(const ScopedPin&) = delete;
+    ScopedPin& operator=(const ScopedPin&) = delete;
+
+private:
+    cpu_set_t previous_;
+    bool restore_ = false;
+};
+
+// restricts the calling thread to the given CPUs for good
+void pin(const cpu_list& cpus);
+} // namespace numa
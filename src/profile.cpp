@@ -0,0 +1,303 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "profile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace profile
+{
+namespace
+{
+uint64_t mix(uint64_t x)
+{
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+int64_t milliseconds(hta::TimePoint time)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+double seconds(hta::Duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+constexpr std::array<double, 7> quantiles = { 0.01, 0.05, 0.25, 0.5, 0.75, 0.95, 0.99 };
+
+nlohmann::json quantiles_json(const QuantileSketch& sketch)
+{
+    auto result = nlohmann::json::object();
+    for (auto q : quantiles)
+    {
+        char key[8];
+        std::snprintf(key, sizeof(key), "%g", q);
+        result[key] = sketch.quantile(q);
+    }
+    return result;
+}
+} // namespace
+
+QuantileSketch::QuantileSketch(double relative_accuracy)
+: gamma_((1 + relative_accuracy) / (1 - relative_accuracy)), log_gamma_(std::log(gamma_))
+{
+}
+
+int QuantileSketch::index(double magnitude) const
+{
+    return static_cast<int>(std::ceil(std::log(magnitude) / log_gamma_));
+}
+
+double QuantileSketch::value(int index) const
+{
+    // the middle of the bucket in terms of the relative error
+    return 2 * std::pow(gamma_, index) / (gamma_ + 1);
+}
+
+void QuantileSketch::add(double value)
+{
+    count_++;
+    // magnitudes this small are zero for all practical purposes and would need many buckets
+    if (std::abs(value) < 1e-9)
+    {
+        zero_++;
+    }
+    else if (value > 0)
+    {
+        positive_[index(value)]++;
+    }
+    else
+    {
+        negative_[index(-value)]++;
+    }
+}
+
+double QuantileSketch::quantile(double q) const
+{
+    if (count_ == 0)
+    {
+        return std::nan("");
+    }
+    auto rank = static_cast<uint64_t>(q * (count_ - 1));
+    uint64_t seen = 0;
+    // from the most negative value upwards
+    for (auto it = negative_.rbegin(); it != negative_.rend(); ++it)
+    {
+        seen += it->second;
+        if (seen > rank)
+        {
+            return -value(it->first);
+        }
+    }
+    seen += zero_;
+    if (seen > rank)
+    {
+        return 0;
+    }
+    for (const auto& bucket : positive_)
+    {
+        seen += bucket.second;
+        if (seen > rank)
+        {
+            return value(bucket.first);
+        }
+    }
+    return value(positive_.rbegin()->first);
+}
+
+void DistinctSketch::add(double value)
+{
+    if (value == 0)
+    {
+        // -0.0 and 0.0 are the same value
+        value = 0;
+    }
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    auto hash = mix(bits);
+    auto index = hash >> (64 - precision);
+    // rank of the first set bit in the remaining bits, the sentinel bounds it
+    auto rest = (hash << precision) | (uint64_t(1) << (precision - 1));
+    auto rank = static_cast<uint8_t>(__builtin_clzll(rest) + 1);
+    registers_[index] = std::max(registers_[index], rank);
+}
+
+double DistinctSketch::estimate() const
+{
+    constexpr double m = 1 << precision;
+    constexpr double alpha = 0.7213 / (1 + 1.079 / m);
+    double sum = 0;
+    int zeros = 0;
+    for (auto r : registers_)
+    {
+        sum += std::ldexp(1.0, -r);
+        zeros += r == 0;
+    }
+    auto estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0)
+    {
+        // linear counting is more precise for small cardinalities
+        estimate = m * std::log(m / zeros);
+    }
+    return estimate;
+}
+
+Profile::Profile(double gap_factor, std::size_t max_gaps)
+: gap_factor_(gap_factor), max_gaps_(max_gaps)
+{
+}
+
+void Profile::add(const hta::TimeValue& tv)
+{
+    if (!std::isfinite(tv.value))
+    {
+        // e.g. "nan" in a dump, it would break the sketches and the range
+        non_finite_++;
+        return;
+    }
+    if (count_ == 0)
+    {
+        min_ = max_ = tv.value;
+        first_ = tv.time;
+    }
+    else
+    {
+        min_ = std::min(min_, tv.value);
+        max_ = std::max(max_, tv.value);
+
+        auto interval = seconds(tv.time - last_);
+        intervals_.add(interval);
+        auto ms = std::max(interval * 1000, 1.0);
+        auto bucket = static_cast<std::size_t>(std::ceil(std::log2(ms)));
+        if (bucket >= interval_histogram_.size())
+        {
+            interval_histogram_.resize(bucket + 1);
+        }
+        interval_histogram_[bucket]++;
+
+        // the median is only trusted once there are some intervals, and it is refreshed now and
+        // then, as reading it iterates the buckets
+        if (intervals_.count() == 100 || intervals_.count() % 4096 == 0)
+        {
+            median_interval_ = intervals_.quantile(0.5);
+        }
+        if (median_interval_ > 0 && interval > gap_factor_ * median_interval_)
+        {
+            gap_count_++;
+            gap_seconds_ += interval;
+            auto shorter = [](const gap& a, const gap& b) { return a.to - a.from > b.to - b.from; };
+            gaps_.push_back({ last_, tv.time });
+            std::push_heap(gaps_.begin(), gaps_.end(), shorter);
+            if (gaps_.size() > max_gaps_)
+            {
+                std::pop_heap(gaps_.begin(), gaps_.end(), shorter);
+                gaps_.pop_back();
+            }
+        }
+    }
+    last_ = tv.time;
+    count_++;
+    sum_ += tv.value;
+    values_.add(tv.value);
+    distinct_.add(tv.value);
+}
+
+nlohmann::json Profile::to_json() const
+{
+    nlohmann::json result = { { "count", count_ } };
+    if (non_finite_ > 0)
+    {
+        result["non_finite_values"] = non_finite_;
+    }
+    if (count_ == 0)
+    {
+        return result;
+    }
+    result["first"] = milliseconds(first_);
+    result["last"] = milliseconds(last_);
+    result["min"] = min_;
+    result["max"] = max_;
+    result["mean"] = sum_ / count_;
+    result["quantiles"] = quantiles_json(values_);
+    result["distinct_values"] = std::llround(distinct_.estimate());
+
+    auto histogram = nlohmann::json::array();
+    for (std::size_t bucket = 0; bucket < interval_histogram_.size(); bucket++)
+    {
+        if (interval_histogram_[bucket] > 0)
+        {
+            histogram.push_back({ { "max_ms", uint64_t(1) << bucket },
+                                  { "count", interval_histogram_[bucket] } });
+        }
+    }
+    result["interval"] = { { "quantiles", intervals_.count() ? quantiles_json(intervals_) :
+                                                                nlohmann::json::object() },
+                           { "histogram", histogram } };
+
+    auto sorted = gaps_;
+    std::sort(sorted.begin(), sorted.end(),
+              [](const gap& a, const gap& b) { return a.to - a.from > b.to - b.from; });
+    auto largest = nlohmann::json::array();
+    for (const auto& g : sorted)
+    {
+        largest.push_back({ { "from", milliseconds(g.from) },
+                            { "to", milliseconds(g.to) },
+                            { "seconds", seconds(g.to - g.from) } });
+    }
+    result["gaps"] = { { "count", gap_count_ },
+                       { "seconds", gap_seconds_ },
+                       { "largest", largest } };
+    return result;
+}
+
+void ProfileSink::write(const Batch& batch)
+{
+    for (const auto& tv : batch.values)
+    {
+        profile_.add(tv);
+    }
+}
+
+void ProfileSink::close()
+{
+    out_ = profile_.to_json();
+}
+} // namespace profile
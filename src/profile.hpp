@@ -0,0 +1,163 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "sink.hpp"
+
+#include <hta/hta.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include <array>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+// Streaming data profiles of a metric, computed from the batches of the import. Each sketch has
+// a bounded size independent of the number of values.
+namespace profile
+{
+// Quantiles with a bounded relative error (DDSketch): values fall into logarithmic buckets,
+// gamma^(i-1) < |v| <= gamma^i.
+class QuantileSketch
+{
+public:
+    explicit QuantileSketch(double relative_accuracy = 0.01);
+
+    void add(double value);
+    double quantile(double q) const;
+
+    uint64_t count() const
+    {
+        return count_;
+    }
+
+private:
+    int index(double magnitude) const;
+    double value(int index) const;
+
+    double gamma_;
+    double log_gamma_;
+    std::map<int, uint64_t> positive_;
+    std::map<int, uint64_t> negative_;
+    uint64_t zero_ = 0;
+    uint64_t count_ = 0;
+};
+
+// Estimates the number of distinct values (HyperLogLog with 4096 registers, ~1.6% error)
+class DistinctSketch
+{
+public:
+    void add(double value);
+    double estimate() const;
+
+private:
+    static constexpr int precision = 12;
+    std::array<uint8_t, 1 << precision> registers_{};
+};
+
+class Profile
+{
+public:
+    // intervals longer than gap_factor times the median interval are gaps
+    explicit Profile(double gap_factor = 10, std::size_t max_gaps = 100);
+
+    // NaN and infinite values are only counted
+    void add(const hta::TimeValue& tv);
+
+    nlohmann::json to_json() const;
+
+private:
+    struct gap
+    {
+        hta::TimePoint from;
+        hta::TimePoint to;
+    };
+
+    double gap_factor_;
+    std::size_t max_gaps_;
+
+    uint64_t count_ = 0;
+    uint64_t non_finite_ = 0;
+    double min_ = 0;
+    double max_ = 0;
+    double sum_ = 0;
+    hta::TimePoint first_;
+    hta::TimePoint last_;
+    QuantileSketch values_;
+    DistinctSketch distinct_;
+
+    // inter-sample intervals in seconds, and as counts per power of two of milliseconds
+    QuantileSketch intervals_;
+    double median_interval_ = 0;
+    std::vector<uint64_t> interval_histogram_;
+    // the longest gaps, as a min-heap on the duration
+    std::vector<gap> gaps_;
+    uint64_t gap_count_ = 0;
+    double gap_seconds_ = 0;
+};
+
+// Profiles the values of a metric from its own writer thread, out is set when the sink is closed
+class ProfileSink : public Sink
+{
+public:
+    ProfileSink(const std::string& metric, nlohmann::json& out) : metric_(metric), out_(out)
+    {
+    }
+
+    void write(const Batch& batch) override;
+
+    void flush() override
+    {
+    }
+
+    void close() override;
+
+    std::string name() const override
+    {
+        return metric_ + " -> profile";
+    }
+
+    // there are no files
+    std::filesystem::path metric_path() const override
+    {
+        return {};
+    }
+
+private:
+    std::string metric_;
+    nlohmann::json& out_;
+    Profile profile_;
+};
+} // namespace profile
@@ -0,0 +1,141 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "import.hpp"
+#include "report.hpp"
+#include "status.hpp"
+
+#include <pybind11/pybind11.h>
+
+#include <atomic>
+#include <memory>
+
+namespace py = pybind11;
+
+namespace
+{
+// A running or finished import, the Python side polls or waits in an executor thread
+class Job
+{
+public:
+    void stop()
+    {
+        stop_requested_ = true;
+    }
+
+    void pause()
+    {
+        pause_requested_ = true;
+    }
+
+    void resume()
+    {
+        pause_requested_ = false;
+    }
+
+    std::string status() const
+    {
+        return status_.to_json().dump();
+    }
+
+    std::atomic<bool> stop_requested_{ false };
+    std::atomic<bool> pause_requested_{ false };
+    Status status_;
+};
+
+// Runs the import with the GIL released, so that several jobs can share one engine from a
+// thread pool. Returns the import report as JSON, with an "error" key if the import failed.
+std::string run(Engine& engine, Job& job, const std::string& config, const std::string& metric,
+                const std::string& import_metric, uint64_t min_timestamp, uint64_t max_timestamp,
+                uint64_t chunk_size, uint64_t packed_rows, bool profile, bool numa,
+                int pipeline, py::object progress)
+{
+    import_options options;
+    options.metric = metric;
+    options.import_metric = import_metric;
+    options.min_timestamp = min_timestamp;
+    options.max_timestamp = max_timestamp;
+    options.chunk_size = chunk_size;
+    options.packed_rows = packed_rows;
+    options.profile = profile;
+    options.numa = numa;
+    options.pipeline = pipeline;
+    options.stop_requested = &job.stop_requested_;
+    options.pause_requested = &job.pause_requested_;
+    if (!progress.is_none())
+    {
+        options.progress = [&progress](uint64_t rows, uint64_t timestamp) {
+            py::gil_scoped_acquire acquire;
+            progress(rows, timestamp);
+        };
+    }
+
+    import_report report;
+    auto parsed_config = nlohmann::json::parse(config);
+    {
+        py::gil_scoped_release release;
+        try
+        {
+            engine.run(parsed_config, options, report, job.status_);
+        }
+        catch (const py::error_already_set&)
+        {
+            // exception raised by the progress callback, let it propagate to Python
+            throw;
+        }
+        catch (const std::exception& e)
+        {
+            report.error = e.what();
+        }
+    }
+    return report.to_json().dump();
+}
+} // namespace
+
+PYBIND11_MODULE(hta_import, m)
+{
+    m.doc() = "Embedded dataheap to HTA import engine of hta_mysql_import";
+
+    py::class_<Job, std::shared_ptr<Job>>(m, "Job")
+        .def(py::init<>())
+        .def("stop", &Job::stop, "stop the import at the next chunk boundary")
+        .def("pause", &Job::pause, "pause the import at the next chunk boundary")
+        .def("resume", &Job::resume, "resume a paused import")
+        .def("status", &Job::status, "live state of the import as JSON");
+
+    py::class_<Engine>(m, "Engine")
+        .def(py::init<>())
+        .def("run", &run, py::arg("job"), py::arg("config"), py::arg("metric"),
+             py::arg("import_metric"), py::arg("min_timestamp") = 0, py::arg("max_timestamp") = 0,
+             py::arg("chunk_size") = 20000000, py::arg("packed_rows") = 0,
+             py::arg("profile") = false, py::arg("numa") = false,
+             py::arg("pipeline") = -1, py::arg("progress") = py::none(),
+             "run an import, returns the report as JSON");
+}
@@ -0,0 +1,100 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "report.hpp"
+
+extern "C"
+{
+#include <sys/resource.h>
+}
+
+namespace
+{
+double seconds(const timeval& tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+} // namespace
+
+nlohmann::json import_report::to_json() const
+{
+    nlohmann::json result = {
+        { "metric", metric },
+        { "import_metric", import_metric },
+        { "rows", rows },
+        { "queries", queries },
+        { "bytes_read", bytes_read },
+        { "wall_time", wall_time },
+        { "query_mode", query_mode },
+        { "hedged_queries", hedged_queries },
+        { "hedge_wins", hedge_wins },
+        { "extreme_values", extreme_values },
+        { "spilled_runs", spilled_runs },
+        { "phases", phases },
+    };
+    if (bytes_written && output_bytes)
+    {
+        result["bytes_written"] = *bytes_written;
+        result["output_bytes"] = *output_bytes;
+    }
+    if (cpu_time_user && cpu_time_system)
+    {
+        result["cpu_time_user"] = *cpu_time_user;
+        result["cpu_time_system"] = *cpu_time_system;
+    }
+    if (peak_rss)
+    {
+        result["peak_rss"] = *peak_rss;
+    }
+    if (!profile.is_null())
+    {
+        result["profile"] = profile;
+    }
+    if (!error.empty())
+    {
+        result["error"] = error;
+    }
+    return result;
+}
+
+thread_cpu thread_cpu::now()
+{
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return { seconds(usage.ru_utime), seconds(usage.ru_stime) };
+}
+
+uint64_t process_peak_rss()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is in KiB on Linux
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+
+#include <cstdint>
+
+// Resource usage of an import, written as JSON for the orchestrator to store in the job document
+struct import_report
+{
+    std::string metric;
+    std::string import_metric;
+    uint64_t rows = 0;
+    uint64_t queries = 0;
+    uint64_t bytes_read = 0;
+    // of the output files, unset in the modes whose writers work for several metrics
+    std::optional<uint64_t> bytes_written;
+    std::optional<uint64_t> output_bytes;
+    double wall_time = 0;
+    // "rows" for one result row per value, "packed" for packed result rows
+    std::string query_mode = "rows";
+    // chunk queries that were issued a second time, and how often the second one won
+    uint64_t hedged_queries = 0;
+    uint64_t hedge_wins = 0;
+    // values beyond +-1e12 that were skipped, the modes that do not fail on them
+    uint64_t extreme_values = 0;
+    // sorted runs of the metric merged from the spill files, only in the line protocol mode
+    uint64_t spilled_runs = 0;
+    // wall time in seconds per phase
+    std::map<std::string, double> phases;
+    // CPU time in seconds of the source and writer threads of this import, unset in the modes
+    // whose threads work for several metrics
+    std::optional<double> cpu_time_user;
+    std::optional<double> cpu_time_system;
+    // peak RSS of the process, only set if the process runs a single import
+    std::optional<uint64_t> peak_rss;
+    // data profile of the imported values, null unless requested
+    nlohmann::json profile;
+    std::string error;
+
+    nlohmann::json to_json() const;
+};
+
+// CPU time of the calling thread
+struct thread_cpu
+{
+    double user = 0;
+    double system = 0;
+
+    static thread_cpu now();
+};
+
+// peak RSS of the process in bytes
+uint64_t process_peak_rss();
+
+// Charges the wall time since the previous call to the given phase of the report
+class PhaseTimer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit PhaseTimer(import_report& report) : report_(report), mark_(clock::now())
+    {
+    }
+
+    void account(const char* phase)
+    {
+        auto now = clock::now();
+        report_.phases[phase] += std::chrono::duration<double>(now - mark_).count();
+        mark_ = now;
+    }
+
+private:
+    import_report& report_;
+    clock::time_point mark_;
+};
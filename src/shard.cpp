@@ -0,0 +1,246 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "shard.hpp"
+#include "metric_cache.hpp"
+
+#include <hta/hta.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+// spin briefly, then back off to short sleeps while waiting for the other side of a queue
+void backoff(std::size_t& idle)
+{
+    if (idle++ < 64)
+    {
+        std::this_thread::yield();
+    }
+    else
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// items taken from one input before looking at the next one
+constexpr std::size_t max_items_per_input = 16;
+} // namespace
+
+ShardedWriter::ShardedWriter(const nlohmann::json& config, const std::vector<std::string>& metrics,
+                             std::size_t shards, std::size_t producers,
+                             std::size_t queue_capacity, std::size_t max_open_metrics,
+                             const numa::Placement* placement)
+: metrics_(metrics), metric_errors_(metrics.size()), metric_failed_(metrics.size()),
+  max_open_metrics_(max_open_metrics)
+{
+    if (shards == 0 || producers == 0)
+    {
+        throw std::invalid_argument("ShardedWriter needs at least one shard and producer");
+    }
+    for (std::size_t i = 0; i < shards; i++)
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->config = config;
+        shard->config["metrics"] = nlohmann::json::array();
+        if (placement)
+        {
+            shard->cpus = placement->cpus(i);
+        }
+        for (std::size_t p = 0; p < producers; p++)
+        {
+            shard->inputs.push_back(std::make_unique<SpscQueue<item>>(queue_capacity));
+        }
+        shards_.push_back(std::move(shard));
+    }
+
+    // each shard only opens the metrics it owns
+    for (const auto& metric_config : config["metrics"])
+    {
+        for (std::size_t metric = 0; metric < metrics_.size(); metric++)
+        {
+            if (metric_config["name"] == metrics_[metric])
+            {
+                shards_[shard_of(metric)]->config["metrics"].push_back(metric_config);
+                break;
+            }
+        }
+    }
+
+    for (auto& shard : shards_)
+    {
+        shard->thread = std::thread([this, &shard = *shard]() { run(shard); });
+    }
+}
+
+ShardedWriter::~ShardedWriter()
+{
+    for (std::size_t p = 0; p < shards_.front()->inputs.size(); p++)
+    {
+        close(p);
+    }
+    for (auto& shard : shards_)
+    {
+        if (shard->thread.joinable())
+        {
+            shard->thread.join();
+        }
+    }
+}
+
+void ShardedWriter::push(std::size_t producer, std::size_t metric,
+                         std::shared_ptr<const Batch> batch)
+{
+    if (metric_failed_[metric].load(std::memory_order_acquire))
+    {
+        // the error itself is returned by finish()
+        throw std::runtime_error("Writing the metric failed.");
+    }
+    auto& shard = *shards_[shard_of(metric)];
+    auto& input = *shard.inputs[producer];
+    item next{ metric, std::move(batch) };
+    std::size_t idle = 0;
+    while (!input.try_push(next))
+    {
+        if (shard.failed.load(std::memory_order_acquire))
+        {
+            throw std::runtime_error("Writer shard failed.");
+        }
+        backoff(idle);
+    }
+}
+
+void ShardedWriter::close(std::size_t producer)
+{
+    for (auto& shard : shards_)
+    {
+        shard->inputs[producer]->close();
+    }
+}
+
+std::vector<std::string> ShardedWriter::finish()
+{
+    for (auto& shard : shards_)
+    {
+        if (shard->thread.joinable())
+        {
+            shard->thread.join();
+        }
+    }
+    auto errors = metric_errors_;
+    for (std::size_t metric = 0; metric < errors.size(); metric++)
+    {
+        const auto& shard = *shards_[shard_of(metric)];
+        if (errors[metric].empty() && !shard.error.empty())
+        {
+            errors[metric] = shard.error;
+        }
+    }
+    return errors;
+}
+
+void ShardedWriter::run(Shard& shard)
+{
+    if (!shard.cpus.empty())
+    {
+        numa::pin(shard.cpus);
+    }
+    try
+    {
+        // created by the owning thread on its node, nobody else ever touches it
+        auto capacity =
+            max_open_metrics_ ? std::max<std::size_t>(1, max_open_metrics_ / shards_.size()) : 0;
+        MetricCache metric_cache(shard.config, capacity, shards_.size());
+
+        std::size_t idle = 0;
+        while (true)
+        {
+            bool busy = false;
+            bool drained = true;
+            for (auto& input : shard.inputs)
+            {
+                bool closed = input->closed();
+                for (std::size_t i = 0; i < max_items_per_input; i++)
+                {
+                    auto next = input->try_pop();
+                    if (!next)
+                    {
+                        break;
+                    }
+                    busy = true;
+                    if (metric_failed_[next->metric].load(std::memory_order_relaxed))
+                    {
+                        continue;
+                    }
+                    try
+                    {
+                        auto& metric = metric_cache.get(metrics_[next->metric]);
+                        for (const auto& tv : next->batch->values)
+                        {
+                            metric.insert(tv);
+                        }
+                        metric.flush();
+                    }
+                    catch (const std::exception& e)
+                    {
+                        // e.g. values before the end of an existing metric, the other metrics of
+                        // the shard are not affected
+                        std::cerr << "[" << metrics_[next->metric] << "] error: " << e.what()
+                                  << std::endl;
+                        metric_errors_[next->metric] = e.what();
+                        metric_failed_[next->metric].store(true, std::memory_order_release);
+                    }
+                }
+                drained = drained && closed && input->empty();
+            }
+            if (drained)
+            {
+                return;
+            }
+            if (busy)
+            {
+                idle = 0;
+            }
+            else
+            {
+                backoff(idle);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "writer shard failed: " << e.what() << std::endl;
+        shard.error = e.what();
+        shard.failed.store(true, std::memory_order_release);
+    }
+}
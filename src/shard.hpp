@@ -0,0 +1,112 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "numa.hpp"
+#include "queue.hpp"
+#include "sink.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes many metrics from one process without sharing a hta::Directory between threads.
+// Every metric is owned by exactly one shard thread, which has its own hta::Directory with just
+// its metrics, so the insert path takes no shared locks. Each producer thread has its own
+// single-producer / single-consumer queue to each shard.
+class ShardedWriter
+{
+public:
+    // max_open_metrics limits the metrics open at a time over all shards, 0 for the limit
+    // given by the file descriptors
+    ShardedWriter(const nlohmann::json& config, const std::vector<std::string>& metrics,
+                  std::size_t shards, std::size_t producers, std::size_t queue_capacity,
+                  std::size_t max_open_metrics = 0, const numa::Placement* placement = nullptr);
+    ~ShardedWriter();
+
+    ShardedWriter(const ShardedWriter&) = delete;
+    ShardedWriter& operator=(const ShardedWriter&) = delete;
+
+    // Called from the given producer thread only. Waits while the queue to the owning shard of
+    // the metric (an index into metrics) is full, throws if writing the metric or its shard
+    // failed.
+    void push(std::size_t producer, std::size_t metric, std::shared_ptr<const Batch> batch);
+
+    // called from the given producer thread once it has pushed all its batches
+    void close(std::size_t producer);
+
+    // Waits until all producers are closed and everything is written. Returns the errors by
+    // metric, empty for the metrics that were written. A metric that failed is skipped from then
+    // on, the other metrics of its shard are still written.
+    std::vector<std::string> finish();
+
+    std::size_t shards() const
+    {
+        return shards_.size();
+    }
+
+    std::size_t shard_of(std::size_t metric) const
+    {
+        return metric % shards_.size();
+    }
+
+private:
+    struct item
+    {
+        std::size_t metric;
+        std::shared_ptr<const Batch> batch;
+    };
+
+    struct Shard
+    {
+        nlohmann::json config;
+        // CPUs to run on, empty to leave the thread unpinned
+        numa::cpu_list cpus;
+        std::vector<std::unique_ptr<SpscQueue<item>>> inputs;
+        std::thread thread;
+        // set if the shard could not write at all
+        std::string error;
+        std::atomic<bool> failed{ false };
+    };
+
+    void run(Shard& shard);
+
+    std::vector<std::string> metrics_;
+    // by metric, each only written by the owning shard
+    std::vector<std::string> metric_errors_;
+    std::vector<std::atomic<bool>> metric_failed_;
+    std::size_t max_open_metrics_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -0,0 +1,87 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <hta/hta.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Validated, monotonic values of one chunk, shared by all writers
+struct Batch
+{
+    std::vector<hta::TimeValue> values;
+};
+
+// Output of a Writer. All methods except the constructor and the accessors are called from the
+// writer thread.
+class Sink
+{
+public:
+    virtual ~Sink() = default;
+
+    virtual void write(const Batch& batch) = 0;
+    virtual void flush() = 0;
+
+    // called once after the last batch
+    virtual void close()
+    {
+    }
+
+    // for log messages, e.g. "metric -> /path"
+    virtual std::string name() const = 0;
+
+    // directory containing the output files of the metric
+    virtual std::filesystem::path metric_path() const = 0;
+};
+
+// Writes into the metric of an hta::Directory
+class HtaSink : public Sink
+{
+public:
+    // config is a complete hta::Directory config, it is reduced to the given metric
+    HtaSink(nlohmann::json config, const std::string& metric);
+
+    void write(const Batch& batch) override;
+    void flush() override;
+
+    std::string name() const override;
+    std::filesystem::path metric_path() const override;
+
+private:
+    std::string metric_;
+    std::filesystem::path path_;
+    hta::Directory directory_;
+    hta::Metric* out_metric_ = nullptr;
+};
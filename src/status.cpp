@@ -0,0 +1,260 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "status.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <system_error>
+
+#include <cerrno>
+#include <cstring>
+
+extern "C"
+{
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+namespace
+{
+// rate windows in seconds
+constexpr int rate_windows[] = { 1, 10, 60 };
+constexpr int max_rate_window = 60;
+
+uint64_t resident_bytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+} // namespace
+
+void Status::set_metric(const std::string& metric, const std::string& import_metric)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    metric_ = metric;
+    import_metric_ = import_metric;
+}
+
+void Status::set_phase(const char* phase)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    phase_ = phase;
+    phase_begin_ = clock::now();
+}
+
+void Status::add_queue(const std::string& name, std::function<std::size_t()> depth)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    queues_[name] = std::move(depth);
+}
+
+void Status::remove_queue(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    queues_.erase(name);
+}
+
+void Status::add_producer(const Status& producer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    producers_.push_back(&producer);
+}
+
+void Status::remove_producer(const Status& producer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    producers_.erase(std::remove(producers_.begin(), producers_.end(), &producer),
+                     producers_.end());
+    rows_.fetch_add(producer.rows_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+uint64_t Status::total_rows() const
+{
+    auto rows = rows_.load(std::memory_order_relaxed);
+    for (const auto* producer : producers_)
+    {
+        rows += producer->rows_.load(std::memory_order_relaxed);
+    }
+    return rows;
+}
+
+void Status::sample()
+{
+    auto now = clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_.emplace_back(now, total_rows());
+    while (samples_.size() > 1 &&
+           now - samples_.front().first > std::chrono::seconds(max_rate_window + 1))
+    {
+        samples_.pop_front();
+    }
+}
+
+nlohmann::json Status::snapshot(clock::time_point now) const
+{
+    nlohmann::json result = {
+        { "metric", metric_ },
+        { "import_metric", import_metric_ },
+        { "phase", phase_ },
+        { "phase_duration", std::chrono::duration<double>(now - phase_begin_).count() },
+        { "timestamp", timestamp_.load(std::memory_order_relaxed) },
+        { "rows", rows_.load(std::memory_order_relaxed) },
+        { "queries_in_flight", queries_in_flight_.load(std::memory_order_relaxed) },
+    };
+
+    auto& queues = result["queues"] = nlohmann::json::object();
+    for (const auto& [name, depth] : queues_)
+    {
+        queues[name] = depth();
+    }
+    return result;
+}
+
+nlohmann::json Status::to_json() const
+{
+    auto now = clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto result = snapshot(now);
+    auto rows = total_rows();
+    result["rows"] = rows;
+    result["resident_bytes"] = resident_bytes();
+    if (!producers_.empty())
+    {
+        auto& producers = result["producers"] = nlohmann::json::array();
+        int queries_in_flight = queries_in_flight_.load(std::memory_order_relaxed);
+        for (const auto* producer : producers_)
+        {
+            std::lock_guard<std::mutex> producer_lock(producer->mutex_);
+            producers.push_back(producer->snapshot(now));
+            queries_in_flight += producer->queries_in_flight_.load(std::memory_order_relaxed);
+        }
+        result["queries_in_flight"] = queries_in_flight;
+    }
+
+    auto& rates = result["rows_per_second"] = nlohmann::json::object();
+    for (auto window : rate_windows)
+    {
+        // oldest sample that is still within the window
+        for (const auto& [time, sample_rows] : samples_)
+        {
+            auto age = std::chrono::duration<double>(now - time).count();
+            if (age <= window + 0.5)
+            {
+                rates[std::to_string(window) + "s"] = age > 0 ? (rows - sample_rows) / age : 0.;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+StatusServer::StatusServer(Status& status, const std::filesystem::path& path)
+: status_(status), path_(path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path_.native().size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("status socket path too long: " + path_.native());
+    }
+    std::strcpy(address.sun_path, path_.c_str());
+
+    socket_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_ < 0)
+    {
+        throw std::system_error(errno, std::system_category(), "status socket");
+    }
+    // a stale socket of a previous run is replaced, anything else makes bind fail
+    struct stat existing;
+    if (::lstat(path_.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+    {
+        ::unlink(path_.c_str());
+    }
+    if (::bind(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        ::listen(socket_, 4) < 0)
+    {
+        auto error = errno;
+        ::close(socket_);
+        throw std::system_error(error, std::system_category(), "status socket " + path_.native());
+    }
+    thread_ = std::thread([this]() { run(); });
+}
+
+StatusServer::~StatusServer()
+{
+    stop_ = true;
+    thread_.join();
+    ::close(socket_);
+    ::unlink(path_.c_str());
+}
+
+void StatusServer::run()
+{
+    auto next_sample = Status::clock::now();
+    while (!stop_)
+    {
+        if (Status::clock::now() >= next_sample)
+        {
+            status_.sample();
+            next_sample += std::chrono::seconds(1);
+        }
+
+        pollfd fd = { socket_, POLLIN, 0 };
+        if (::poll(&fd, 1, 200) <= 0)
+        {
+            continue;
+        }
+        int client = ::accept4(socket_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            continue;
+        }
+        auto message = status_.to_json().dump() + "\n";
+        std::size_t written = 0;
+        while (written < message.size())
+        {
+            auto ret = ::send(client, message.data() + written, message.size() - written,
+                              MSG_NOSIGNAL);
+            if (ret <= 0)
+            {
+                break;
+            }
+            written += ret;
+        }
+        ::close(client);
+    }
+}
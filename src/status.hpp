@@ -0,0 +1,134 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+// Live state of a running import. Updated by the import loop, read by the StatusServer.
+class Status
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    void set_metric(const std::string& metric, const std::string& import_metric);
+    void set_phase(const char* phase);
+
+    // called per row, must stay cheap
+    void row(uint64_t dataheap_timestamp)
+    {
+        rows(1, dataheap_timestamp);
+    }
+
+    // publishes the rows read since the last call, for loops that count them per chunk or batch
+    void rows(uint64_t count, uint64_t last_dataheap_timestamp)
+    {
+        rows_.fetch_add(count, std::memory_order_relaxed);
+        timestamp_.store(last_dataheap_timestamp, std::memory_order_relaxed);
+    }
+
+    void begin_query()
+    {
+        queries_in_flight_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void end_query()
+    {
+        queries_in_flight_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // stages register the depth of the queue they consume from
+    void add_queue(const std::string& name, std::function<std::size_t()> depth);
+    void remove_queue(const std::string& name);
+
+    // Producers that import several metrics side by side report their metric, phase and
+    // timestamp in a Status of their own. Their rows and queries count towards this one.
+    void add_producer(const Status& producer);
+    // keeps the rows of the producer in the count
+    void remove_producer(const Status& producer);
+
+    // records the current row count for the sliding rate windows, called once per second
+    void sample();
+
+    nlohmann::json to_json() const;
+
+private:
+    // the state of this Status alone, mutex_ must be held
+    nlohmann::json snapshot(clock::time_point now) const;
+    // including the producers, mutex_ must be held
+    uint64_t total_rows() const;
+
+    mutable std::mutex mutex_;
+    std::string metric_;
+    std::string import_metric_;
+    const char* phase_ = "startup";
+    clock::time_point phase_begin_ = clock::now();
+    std::map<std::string, std::function<std::size_t()>> queues_;
+    std::deque<std::pair<clock::time_point, uint64_t>> samples_;
+    std::vector<const Status*> producers_;
+
+    std::atomic<uint64_t> rows_{ 0 };
+    std::atomic<uint64_t> timestamp_{ 0 };
+    std::atomic<int> queries_in_flight_{ 0 };
+};
+
+// Serves a JSON snapshot of the Status to every client connecting to a local Unix socket,
+// e.g. socat - UNIX-CONNECT:/path/to/socket
+class StatusServer
+{
+public:
+    StatusServer(Status& status, const std::filesystem::path& path);
+    ~StatusServer();
+
+    StatusServer(const StatusServer&) = delete;
+    StatusServer& operator=(const StatusServer&) = delete;
+
+private:
+    void run();
+
+    Status& status_;
+    std::filesystem::path path_;
+    int socket_ = -1;
+    std::atomic<bool> stop_{ false };
+    std::thread thread_;
+};
@@ -0,0 +1,688 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+#include <cerrno>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define HTA_IMPORT_HAVE_IO_URING
+extern "C"
+{
+#include <linux/io_uring.h>
+}
+#endif
+
+namespace uring
+{
+namespace
+{
+[[noreturn]] void throw_errno(const std::string& what, int error = errno)
+{
+    throw std::system_error(error, std::generic_category(), what);
+}
+
+// blocking read of the whole range, for the fallbacks and to complete short reads
+void pread_all(int fd, char* buffer, std::size_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        auto result = ::pread(fd, buffer, length, offset);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw_errno("pread");
+        }
+        if (result == 0)
+        {
+            throw std::runtime_error("unexpected end of file");
+        }
+        buffer += result;
+        length -= result;
+        offset += result;
+    }
+}
+} // namespace
+
+#ifdef HTA_IMPORT_HAVE_IO_URING
+
+namespace
+{
+unsigned load_acquire(const unsigned* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void store_release(unsigned* p, unsigned value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+template <typename T>
+T* at(void* base, std::size_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+} // namespace
+
+Ring::Ring(unsigned entries)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0)
+    {
+        return;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                    IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED)
+    {
+        sq_ring_ = nullptr;
+        close(fd);
+        return;
+    }
+    if (single_mmap)
+    {
+        cq_ring_ = sq_ring_;
+    }
+    else
+    {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_SQES);
+    if (cq_ring_ == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (cq_ring_ != MAP_FAILED && !single_mmap)
+        {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sqes != MAP_FAILED)
+        {
+            munmap(sqes, sqes_size_);
+        }
+        munmap(sq_ring_, sq_ring_size_);
+        sq_ring_ = cq_ring_ = nullptr;
+        close(fd);
+        return;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    sq_head_ = at<unsigned>(sq_ring_, params.sq_off.head);
+    sq_tail_ = at<unsigned>(sq_ring_, params.sq_off.tail);
+    sq_mask_ = at<unsigned>(sq_ring_, params.sq_off.ring_mask);
+    sq_array_ = at<unsigned>(sq_ring_, params.sq_off.array);
+    cq_head_ = at<unsigned>(cq_ring_, params.cq_off.head);
+    cq_tail_ = at<unsigned>(cq_ring_, params.cq_off.tail);
+    cq_mask_ = at<unsigned>(cq_ring_, params.cq_off.ring_mask);
+    cqes_ = at<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+
+    entries_ = params.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+    fd_ = fd;
+}
+
+Ring::~Ring()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    munmap(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_)
+    {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    munmap(sq_ring_, sq_ring_size_);
+    close(fd_);
+}
+
+bool Ring::register_buffers(const std::vector<iovec>& buffers)
+{
+    if (fd_ < 0)
+    {
+        return false;
+    }
+    return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                   static_cast<unsigned>(buffers.size())) == 0;
+}
+
+io_uring_sqe* Ring::next_sqe()
+{
+    // Operations in flight are bounded by the ring size as well, so that their completions
+    // always fit into the completion queue. Callers reap completions with wait() meanwhile.
+    if (fd_ < 0 || sq_local_tail_ - load_acquire(sq_head_) >= entries_ ||
+        in_flight_ + to_submit_ >= entries_)
+    {
+        return nullptr;
+    }
+    auto index = sq_local_tail_ & *sq_mask_;
+    auto* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    sq_local_tail_++;
+    to_submit_++;
+    return sqe;
+}
+
+bool Ring::read_fixed(int fd, void* buffer, unsigned length, uint64_t offset,
+                      unsigned buffer_index, uint64_t user_data)
+{
+    auto* sqe = next_sqe();
+    if (!sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->buf_index = static_cast<uint16_t>(buffer_index);
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool Ring::read(int fd, void* buffer, unsigned length, uint64_t offset, uint64_t user_data)
+{
+    auto* sqe = next_sqe();
+    if (!sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool Ring::fdatasync(int fd, uint64_t user_data)
+{
+    auto* sqe = next_sqe();
+    if (!sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data = user_data;
+    return true;
+}
+
+void Ring::enter(unsigned min_complete)
+{
+    store_release(sq_tail_, sq_local_tail_);
+    while (true)
+    {
+        auto submitted = syscall(__NR_io_uring_enter, fd_, to_submit_, min_complete,
+                                 min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (submitted >= 0)
+        {
+            in_flight_ += static_cast<unsigned>(submitted);
+            to_submit_ -= static_cast<unsigned>(submitted);
+            if (to_submit_ == 0 || min_complete)
+            {
+                return;
+            }
+        }
+        else if (errno == EBUSY)
+        {
+            // the completion queue is full, the caller has to reap before anything is submitted
+            return;
+        }
+        else if (errno != EINTR && errno != EAGAIN)
+        {
+            throw_errno("io_uring_enter");
+        }
+    }
+}
+
+void Ring::submit()
+{
+    if (fd_ >= 0 && to_submit_ > 0)
+    {
+        enter(0);
+    }
+}
+
+std::optional<completion> Ring::peek()
+{
+    if (fd_ < 0)
+    {
+        return std::nullopt;
+    }
+    auto head = *cq_head_;
+    if (head == load_acquire(cq_tail_))
+    {
+        return std::nullopt;
+    }
+    const auto& cqe = cqes_[head & *cq_mask_];
+    completion result{ cqe.user_data, cqe.res };
+    store_release(cq_head_, head + 1);
+    in_flight_--;
+    return result;
+}
+
+completion Ring::wait()
+{
+    while (true)
+    {
+        if (auto result = peek())
+        {
+            return *result;
+        }
+        if (in_flight_ == 0 && to_submit_ == 0)
+        {
+            throw std::logic_error("waiting on an idle io_uring");
+        }
+        enter(1);
+    }
+}
+
+#else
+
+Ring::Ring(unsigned)
+{
+}
+
+Ring::~Ring()
+{
+}
+
+bool Ring::register_buffers(const std::vector<iovec>&)
+{
+    return false;
+}
+
+io_uring_sqe* Ring::next_sqe()
+{
+    return nullptr;
+}
+
+bool Ring::read_fixed(int, void*, unsigned, uint64_t, unsigned, uint64_t)
+{
+    return false;
+}
+
+bool Ring::read(int, void*, unsigned, uint64_t, uint64_t)
+{
+    return false;
+}
+
+bool Ring::fdatasync(int, uint64_t)
+{
+    return false;
+}
+
+void Ring::enter(unsigned)
+{
+}
+
+void Ring::submit()
+{
+}
+
+std::optional<completion> Ring::peek()
+{
+    return std::nullopt;
+}
+
+completion Ring::wait()
+{
+    throw std::logic_error("io_uring is not available");
+}
+
+#endif
+
+FileReader::FileReader(const std::filesystem::path& path, std::size_t block_size, unsigned depth,
+                       bool drop_cache)
+: block_size_(block_size), drop_cache_(drop_cache), buffers_(std::max(depth, 1u)),
+  results_(buffers_.size())
+{
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0)
+    {
+        throw_errno("open " + path.string());
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0)
+    {
+        auto error = errno;
+        close(fd_);
+        throw_errno("fstat " + path.string(), error);
+    }
+    size_ = static_cast<uint64_t>(st.st_size);
+    // doubles the readahead window, the hint is advisory and may fail harmlessly
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    std::vector<iovec> iovecs;
+    for (auto& buffer : buffers_)
+    {
+        buffer.resize(block_size_);
+        iovecs.push_back({ buffer.data(), buffer.size() });
+    }
+
+    ring_.emplace(static_cast<unsigned>(buffers_.size()));
+    if (!ring_->available())
+    {
+        ring_.reset();
+        return;
+    }
+    fixed_ = ring_->register_buffers(iovecs);
+    for (unsigned buffer = 0; buffer < buffers_.size() && queue_offset_ < size_; buffer++)
+    {
+        queue(buffer);
+    }
+    ring_->submit();
+}
+
+FileReader::~FileReader()
+{
+    // the kernel may still write into the buffers
+    try
+    {
+        while (ring_ && ring_->in_flight() > 0)
+        {
+            ring_->wait();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "io_uring: " << e.what() << std::endl;
+    }
+    close(fd_);
+}
+
+void FileReader::queue(unsigned buffer)
+{
+    auto length = static_cast<unsigned>(std::min<uint64_t>(block_size_, size_ - queue_offset_));
+    auto* data = buffers_[buffer].data();
+    bool queued = fixed_ ? ring_->read_fixed(fd_, data, length, queue_offset_, buffer, buffer) :
+                           ring_->read(fd_, data, length, queue_offset_, buffer);
+    if (!queued)
+    {
+        // cannot happen, there is one entry per buffer
+        throw std::logic_error("io_uring submission queue full");
+    }
+    results_[buffer].reset();
+    queue_offset_ += length;
+}
+
+std::string_view FileReader::next()
+{
+    if (drop_cache_ && read_offset_ > dropped_offset_)
+    {
+        // the returned blocks are consumed, a source file is read exactly once
+        posix_fadvise(fd_, dropped_offset_, read_offset_ - dropped_offset_, POSIX_FADV_DONTNEED);
+        dropped_offset_ = read_offset_;
+    }
+    if (read_offset_ >= size_)
+    {
+        return {};
+    }
+    auto length = static_cast<std::size_t>(std::min<uint64_t>(block_size_, size_ - read_offset_));
+
+    if (!ring_)
+    {
+        pread_all(fd_, buffers_[0].data(), length, read_offset_);
+        read_offset_ += length;
+        return { buffers_[0].data(), length };
+    }
+
+    if (returned_)
+    {
+        if (queue_offset_ < size_)
+        {
+            queue(*returned_);
+        }
+        returned_.reset();
+        ring_->submit();
+    }
+
+    auto buffer = next_buffer_;
+    while (!results_[buffer])
+    {
+        auto done = ring_->wait();
+        results_[done.user_data] = done.result;
+    }
+    if (*results_[buffer] < 0)
+    {
+        throw_errno("io_uring read", -*results_[buffer]);
+    }
+    auto result = static_cast<std::size_t>(*results_[buffer]);
+    if (result < length)
+    {
+        // short read, complete it synchronously
+        pread_all(fd_, buffers_[buffer].data() + result, length - result, read_offset_ + result);
+    }
+    read_offset_ += length;
+    next_buffer_ = (buffer + 1) % buffers_.size();
+    returned_ = buffer;
+    return { buffers_[buffer].data(), length };
+}
+
+SyncQueue::SyncQueue() : requests_(1024)
+{
+    thread_ = std::thread([this]() { run(); });
+}
+
+SyncQueue::~SyncQueue()
+{
+    requests_.close();
+    thread_.join();
+}
+
+SyncQueue& SyncQueue::instance()
+{
+    static SyncQueue queue;
+    return queue;
+}
+
+std::future<void> SyncQueue::sync_directory(const std::filesystem::path& directory,
+                                            bool drop_cache)
+{
+    request r{ directory, drop_cache, {} };
+    auto future = r.done.get_future();
+    requests_.push(std::move(r));
+    return future;
+}
+
+void SyncQueue::run()
+{
+    Ring ring(256);
+    while (auto first = requests_.pop())
+    {
+        // everything that piled up meanwhile is synced in one batch
+        std::vector<request> batch;
+        batch.push_back(std::move(*first));
+        while (auto more = requests_.try_pop())
+        {
+            batch.push_back(std::move(*more));
+        }
+
+        struct file
+        {
+            int fd;
+            std::size_t request;
+            std::string path;
+            bool failed = false;
+        };
+        std::vector<file> files;
+        std::vector<std::exception_ptr> errors(batch.size());
+        auto fail = [&errors](std::size_t request, const std::string& what, int error) {
+            if (!errors[request])
+            {
+                errors[request] = std::make_exception_ptr(
+                    std::system_error(error, std::generic_category(), what));
+            }
+        };
+
+        for (std::size_t i = 0; i < batch.size(); i++)
+        {
+            std::error_code ec;
+            std::vector<std::filesystem::path> paths = { batch[i].directory };
+            for (const auto& entry : std::filesystem::directory_iterator(batch[i].directory, ec))
+            {
+                if (entry.is_regular_file(ec))
+                {
+                    paths.push_back(entry.path());
+                }
+            }
+            if (ec)
+            {
+                fail(i, "list " + batch[i].directory.string(), ec.value());
+            }
+            for (std::size_t p = 0; p < paths.size(); p++)
+            {
+                const auto& path = paths[p];
+                int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                {
+                    fail(i, "open " + path.string(), errno);
+                    continue;
+                }
+                // the directory itself is never dropped
+                files.push_back({ fd, i, p == 0 ? std::string() : path.string() });
+            }
+        }
+
+        if (ring.available())
+        {
+            std::size_t completed = 0;
+            auto handle = [&](const completion& done) {
+                if (done.result < 0)
+                {
+                    fail(files[done.user_data].request, "fdatasync", -done.result);
+                    files[done.user_data].failed = true;
+                }
+                completed++;
+            };
+            for (std::size_t i = 0; i < files.size(); i++)
+            {
+                while (!ring.fdatasync(files[i].fd, i))
+                {
+                    handle(ring.wait());
+                }
+            }
+            while (completed < files.size())
+            {
+                handle(ring.wait());
+            }
+        }
+        else
+        {
+            for (auto& f : files)
+            {
+                if (::fdatasync(f.fd) != 0)
+                {
+                    fail(f.request, "fdatasync", errno);
+                    f.failed = true;
+                }
+            }
+        }
+
+        for (const auto& f : files)
+        {
+            if (batch[f.request].drop_cache && !f.failed && !f.path.empty())
+            {
+                drop(f.fd, f.path);
+            }
+            close(f.fd);
+        }
+        for (std::size_t i = 0; i < batch.size(); i++)
+        {
+            if (errors[i])
+            {
+                batch[i].done.set_exception(errors[i]);
+            }
+            else
+            {
+                batch[i].done.set_value();
+            }
+        }
+    }
+}
+
+void SyncQueue::drop(int fd, const std::string& path)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        return;
+    }
+    // Only whole pages: dropping the partial last page would make the next append read it back
+    // from disk. The files are append-only, so everything below the previous end is clean.
+    static const off_t page_size = sysconf(_SC_PAGESIZE);
+    off_t end = st.st_size / page_size * page_size;
+    auto& dropped = dropped_[path];
+    if (end < dropped)
+    {
+        // truncated or replaced
+        dropped = 0;
+    }
+    if (end > dropped)
+    {
+        posix_fadvise(fd, dropped, end - dropped, POSIX_FADV_DONTNEED);
+        dropped = end;
+    }
+}
+} // namespace uring
@@ -0,0 +1,210 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "queue.hpp"
+
+#include <filesystem>
+#include <future>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+extern "C"
+{
+#include <sys/types.h>
+#include <sys/uio.h>
+}
+
+// from <linux/io_uring.h>, which is only included by the implementation
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Asynchronous file I/O on io_uring, implemented on the raw system calls so that there is no
+// dependency on liburing. If the kernel (or a seccomp profile) does not allow io_uring, the
+// classes fall back to the equivalent blocking calls.
+namespace uring
+{
+struct completion
+{
+    uint64_t user_data;
+    // result of the operation, negative errno on failure
+    int result;
+};
+
+class Ring
+{
+public:
+    explicit Ring(unsigned entries);
+    ~Ring();
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    bool available() const
+    {
+        return fd_ >= 0;
+    }
+
+    // pins the buffers for read_fixed, returns false if the kernel refused (e.g. RLIMIT_MEMLOCK)
+    bool register_buffers(const std::vector<iovec>& buffers);
+
+    // Queue an operation, return false if the submission queue is full or as many operations
+    // as it has entries are in flight; wait() then frees one. Nothing is passed to the kernel
+    // before submit() or wait().
+    bool read_fixed(int fd, void* buffer, unsigned length, uint64_t offset, unsigned buffer_index,
+                    uint64_t user_data);
+    bool read(int fd, void* buffer, unsigned length, uint64_t offset, uint64_t user_data);
+    bool fdatasync(int fd, uint64_t user_data);
+
+    // passes the queued operations to the kernel, without waiting
+    void submit();
+
+    // next completion, if there is one
+    std::optional<completion> peek();
+
+    // submits the queued operations and waits for the next completion
+    completion wait();
+
+    // operations submitted, but not yet completed
+    unsigned in_flight() const
+    {
+        return in_flight_;
+    }
+
+private:
+    ::io_uring_sqe* next_sqe();
+    void enter(unsigned min_complete);
+
+    int fd_ = -1;
+    unsigned entries_ = 0;
+
+    void* sq_ring_ = nullptr;
+    std::size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    std::size_t cq_ring_size_ = 0;
+    ::io_uring_sqe* sqes_ = nullptr;
+    std::size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    ::io_uring_cqe* cqes_ = nullptr;
+
+    // tail of the submission queue, published to the kernel on submit
+    unsigned sq_local_tail_ = 0;
+    unsigned to_submit_ = 0;
+    unsigned in_flight_ = 0;
+};
+
+// Sequential reader for file based sources. Keeps several reads in flight into registered
+// buffers, so that decoding one block overlaps with reading the next ones. With drop_cache, the
+// consumed blocks are dropped from the page cache.
+class FileReader
+{
+public:
+    explicit FileReader(const std::filesystem::path& path, std::size_t block_size = 1 << 20,
+                        unsigned depth = 4, bool drop_cache = false);
+    ~FileReader();
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    // next block of the file, valid until the next call, empty at the end of the file
+    std::string_view next();
+
+    uint64_t size() const
+    {
+        return size_;
+    }
+
+private:
+    void queue(unsigned buffer);
+
+    int fd_;
+    uint64_t size_ = 0;
+    std::size_t block_size_;
+    bool drop_cache_;
+    uint64_t dropped_offset_ = 0;
+    std::vector<std::vector<char>> buffers_;
+    std::optional<Ring> ring_;
+    bool fixed_ = false;
+    // offset of the next read to queue and of the next block to return
+    uint64_t queue_offset_ = 0;
+    uint64_t read_offset_ = 0;
+    // buffer holding the next block, blocks are read into the buffers round-robin
+    unsigned next_buffer_ = 0;
+    // the previously returned buffer, requeued on the next call
+    std::optional<unsigned> returned_;
+    std::vector<std::optional<int>> results_;
+};
+
+// A thread that makes files durable with batched fdatasync calls, all files of all pending
+// requests in flight at once. Shared by all writers of the process.
+class SyncQueue
+{
+public:
+    SyncQueue();
+    ~SyncQueue();
+
+    // fdatasync for all regular files in the directory and for the directory itself, with
+    // drop_cache the data of the files that is durable now is dropped from the page cache
+    std::future<void> sync_directory(const std::filesystem::path& directory,
+                                     bool drop_cache = false);
+
+    static SyncQueue& instance();
+
+private:
+    struct request
+    {
+        std::filesystem::path directory;
+        bool drop_cache;
+        std::promise<void> done;
+    };
+
+    void run();
+    void drop(int fd, const std::string& path);
+
+    BlockingQueue<request> requests_;
+    // end of the range already dropped per file, only used by the thread
+    std::unordered_map<std::string, off_t> dropped_;
+    std::thread thread_;
+};
+} // namespace uring
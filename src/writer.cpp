@@ -0,0 +1,130 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "writer.hpp"
+#include "uring.hpp"
+
+#include <chrono>
+
+Writer::Writer(std::unique_ptr<Sink> sink, bool report_allocations, std::size_t queue_capacity,
+               bool durable, bool drop_cache)
+: sink_(std::move(sink)), name_(sink_->name()), footprint_(name_, sink_->metric_path()),
+  allocations_(name_, report_allocations), durable_(durable || drop_cache), drop_cache_(drop_cache),
+  queue_(queue_capacity)
+{
+    thread_ = std::thread([this]() { run(); });
+}
+
+Writer::~Writer()
+{
+    queue_.close();
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void Writer::push(std::shared_ptr<const Batch> batch)
+{
+    if (!queue_.push(std::move(batch)))
+    {
+        finish();
+    }
+}
+
+void Writer::finish()
+{
+    queue_.close();
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+    if (error_)
+    {
+        std::rethrow_exception(error_);
+    }
+}
+
+void Writer::run()
+{
+    using clock = std::chrono::steady_clock;
+    try
+    {
+        while (auto batch = queue_.pop())
+        {
+            auto begin = clock::now();
+            footprint_.begin_write();
+            allocations_.restart();
+            sink_->write(**batch);
+            allocations_.account(alloc_stats::phase::insert);
+            auto inserted = clock::now();
+            sink_->flush();
+            if (durable_)
+            {
+                sync();
+            }
+            allocations_.account(alloc_stats::phase::flush);
+            footprint_.end_write();
+            allocations_.end_chunk((*batch)->values.size());
+            insert_seconds_ += std::chrono::duration<double>(inserted - begin).count();
+            flush_seconds_ += std::chrono::duration<double>(clock::now() - inserted).count();
+        }
+        footprint_.begin_write();
+        sink_->close();
+        if (durable_)
+        {
+            sync();
+            sync_.get();
+        }
+        footprint_.end_write();
+        cpu_ = thread_cpu::now();
+    }
+    catch (...)
+    {
+        if (sync_.valid())
+        {
+            sync_.wait();
+        }
+        cpu_ = thread_cpu::now();
+        error_ = std::current_exception();
+        // unblocks the producer, which then picks up the error
+        queue_.close();
+    }
+}
+
+void Writer::sync()
+{
+    // at most one sync per writer in flight, which bounds the dirty data to about one batch
+    if (sync_.valid())
+    {
+        sync_.get();
+    }
+    sync_ = uring::SyncQueue::instance().sync_directory(sink_->metric_path(), drop_cache_);
+}
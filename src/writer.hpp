@@ -0,0 +1,120 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "alloc_stats.hpp"
+#include "footprint.hpp"
+#include "queue.hpp"
+#include "report.hpp"
+#include "sink.hpp"
+
+#include <exception>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Writes the batches of one metric into a Sink from its own thread
+class Writer
+{
+public:
+    // if durable, the files of each flush are synced in the background, the writer only waits
+    // for the previous flush to be durable before it issues the next sync. drop_cache implies
+    // durable and drops the synced data from the page cache.
+    Writer(std::unique_ptr<Sink> sink, bool report_allocations, std::size_t queue_capacity,
+           bool durable = false, bool drop_cache = false);
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    // blocks while the queue is full, rethrows errors of the writer thread
+    void push(std::shared_ptr<const Batch> batch);
+
+    // waits until all batches are written, rethrows errors of the writer thread
+    void finish();
+
+    std::size_t queue_depth() const
+    {
+        return queue_.size();
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+    // valid after finish()
+    const footprint::Report& footprint() const
+    {
+        return footprint_;
+    }
+
+    const alloc_stats::Accounting& allocations() const
+    {
+        return allocations_;
+    }
+
+    double insert_seconds() const
+    {
+        return insert_seconds_;
+    }
+
+    double flush_seconds() const
+    {
+        return flush_seconds_;
+    }
+
+    // CPU time of the writer thread, valid after finish()
+    const thread_cpu& cpu() const
+    {
+        return cpu_;
+    }
+
+private:
+    void run();
+    void sync();
+
+    std::unique_ptr<Sink> sink_;
+    std::string name_;
+    footprint::Report footprint_;
+    alloc_stats::Accounting allocations_;
+    double insert_seconds_ = 0;
+    double flush_seconds_ = 0;
+    thread_cpu cpu_;
+    bool durable_;
+    bool drop_cache_;
+    std::future<void> sync_;
+
+    BlockingQueue<std::shared_ptr<const Batch>> queue_;
+    std::exception_ptr error_;
+    std::thread thread_;
+};
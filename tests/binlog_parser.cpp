@@ -0,0 +1,282 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "../src/binlog.hpp"
+#include "check.hpp"
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+struct row
+{
+    std::string table;
+    int64_t timestamp;
+    double value;
+};
+
+void put(std::string& out, uint64_t value, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; i++)
+    {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+void put_double(std::string& out, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    put(out, bits, 8);
+}
+
+std::string event(uint8_t type, const std::string& body, bool checksum)
+{
+    std::string result;
+    put(result, 0, 4);
+    put(result, type, 1);
+    put(result, 1, 4);
+    put(result, 19 + body.size() + (checksum ? 4 : 0), 4);
+    put(result, 0, 4);
+    put(result, 0, 2);
+    result += body;
+    if (checksum)
+    {
+        put(result, 0xdeadbeef, 4);
+    }
+    return result;
+}
+
+std::string table_map(uint64_t id, const std::string& schema, const std::string& table,
+                      const std::string& types)
+{
+    std::string body;
+    put(body, id, 6);
+    put(body, 0, 2);
+    put(body, schema.size(), 1);
+    body += schema + '\0';
+    put(body, table.size(), 1);
+    body += table + '\0';
+    put(body, types.size(), 1);
+    body += types;
+    // metadata of the columns, the pack length of the floating point ones
+    put(body, 1, 1);
+    put(body, 8, 1);
+    put(body, 0, 1);
+    return body;
+}
+
+// write rows v2 of a (BIGINT, DOUBLE) table, a missing value is NULL
+std::string write_rows(uint64_t id, const std::vector<std::pair<int64_t, const double*>>& rows)
+{
+    std::string body;
+    put(body, id, 6);
+    put(body, 0, 2);
+    put(body, 2, 2);
+    put(body, 2, 1);
+    put(body, 0x3, 1);
+    for (const auto& [timestamp, value] : rows)
+    {
+        put(body, value ? 0 : 0x2, 1);
+        put(body, static_cast<uint64_t>(timestamp), 8);
+        if (value)
+        {
+            put_double(body, *value);
+        }
+    }
+    return body;
+}
+
+std::string base64(const std::string& data)
+{
+    static const char* alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+    for (std::size_t i = 0; i < data.size(); i += 3)
+    {
+        uint32_t bits = static_cast<uint8_t>(data[i]) << 16;
+        if (i + 1 < data.size())
+        {
+            bits |= static_cast<uint8_t>(data[i + 1]) << 8;
+        }
+        if (i + 2 < data.size())
+        {
+            bits |= static_cast<uint8_t>(data[i + 2]);
+        }
+        result.push_back(alphabet[(bits >> 18) & 63]);
+        result.push_back(alphabet[(bits >> 12) & 63]);
+        result.push_back(i + 1 < data.size() ? alphabet[(bits >> 6) & 63] : '=');
+        result.push_back(i + 2 < data.size() ? alphabet[bits & 63] : '=');
+    }
+    return result;
+}
+
+// feeds a BINLOG statement the way mysqlbinlog prints it, in lines of 76 characters
+void feed_statement(binlog::Parser& parser, const std::string& events)
+{
+    parser.feed("BINLOG '");
+    auto text = base64(events);
+    for (std::size_t i = 0; i < text.size(); i += 76)
+    {
+        parser.feed(text.substr(i, 76));
+    }
+    parser.feed("'/*!*/;");
+}
+
+const std::string bigint_double = std::string{ 8, 5 };
+
+void exact_values(bool checksum)
+{
+    std::vector<row> rows;
+    binlog::Parser parser(
+        [&rows](const std::string& schema, const std::string& table, int64_t timestamp,
+                double value) {
+            CHECK(schema == "dataheap");
+            rows.push_back({ table, timestamp, value });
+        });
+
+    std::string crc = checksum ? " CRC32 0x5a4c6b1d" : "";
+    parser.feed("# at 4");
+    parser.feed("#230101 12:00:00 server id 1  end_log_pos 125" + crc + " \tStart: binlog v 4");
+    // the format description is not needed for decoding the rows
+    feed_statement(parser, event(15, std::string(100, '\0'), checksum));
+
+    double precise = 0.1 + 0.2;
+    double digits = 1.2345678901234567;
+    double large = 123456789.98765432;
+    parser.feed("#230101 12:00:01 server id 1  end_log_pos 300" + crc + " \tWrite_rows");
+    feed_statement(parser, event(19, table_map(42, "dataheap", "foo_bar", bigint_double),
+                                 checksum) +
+                               event(30,
+                                     write_rows(42, { { 1600000000000, &precise },
+                                                      { 1600000000001, nullptr },
+                                                      { 1600000000002, &digits },
+                                                      { 1600000000003, &large } }),
+                                     checksum));
+    parser.feed("COMMIT/*!*/;");
+
+    CHECK(rows.size() == 3);
+    CHECK(rows[0].table == "foo_bar");
+    CHECK(rows[0].timestamp == 1600000000000);
+    // bit-exact, not rounded to the 6 digits of the pseudo SQL
+    CHECK(rows[0].value == precise);
+    CHECK(rows[1].timestamp == 1600000000002);
+    CHECK(rows[1].value == digits);
+    CHECK(rows[2].value == large);
+    CHECK(parser.committed_position() == 300);
+}
+
+void filtered_and_ignored_rows()
+{
+    std::vector<row> rows;
+    binlog::Parser parser(
+        [&rows](const std::string&, const std::string& table, int64_t timestamp, double value) {
+            rows.push_back({ table, timestamp, value });
+        },
+        [](const std::string&, const std::string& table) { return table != "other"; });
+
+    double value = 2.5;
+    // a table with a VARCHAR column is fine as long as it is not followed
+    std::string other_types{ 8, 15 };
+    std::string other = table_map(7, "dataheap", "other", other_types);
+    std::string other_rows;
+    put(other_rows, 7, 6);
+    put(other_rows, 0, 2);
+    put(other_rows, 2, 2);
+    other_rows += "opaque row image";
+
+    // update rows v2: two bitmaps, before and after image per row
+    std::string update;
+    put(update, 42, 6);
+    put(update, 0, 2);
+    put(update, 2, 2);
+    put(update, 2, 1);
+    put(update, 0x3, 1);
+    put(update, 0x3, 1);
+    for (int image = 0; image < 2; image++)
+    {
+        put(update, 0, 1);
+        put(update, 1000, 8);
+        put_double(update, value + image);
+    }
+
+    parser.feed("#230101 12:00:01 server id 1  end_log_pos 400 \tTable_map");
+    feed_statement(parser, event(19, other, false) + event(30, other_rows, false) +
+                               event(19, table_map(42, "dataheap", "foo", bigint_double), false) +
+                               event(31, update, false) +
+                               event(30, write_rows(42, { { 2000, &value } }), false));
+    parser.feed("COMMIT/*!*/;");
+
+    CHECK(rows.size() == 1);
+    CHECK(rows[0].table == "foo");
+    CHECK(rows[0].timestamp == 2000);
+    CHECK(rows[0].value == value);
+    CHECK(parser.ignored_rows() == 1);
+}
+
+void rotate()
+{
+    binlog::Parser parser([](const std::string&, const std::string&, int64_t, double) {});
+    parser.feed("#230101 12:00:00 server id 1  end_log_pos 0 \tRotate to binlog.000043  pos: 4");
+    CHECK(parser.file() == "binlog.000043");
+    CHECK(parser.committed_position() == 4);
+}
+
+void unsupported_columns()
+{
+    binlog::Parser parser([](const std::string&, const std::string&, int64_t, double) {});
+    parser.feed("#230101 12:00:01 server id 1  end_log_pos 400 \tTable_map");
+    bool thrown = false;
+    try
+    {
+        // DECIMAL values cannot be decoded
+        feed_statement(parser, event(19, table_map(1, "db", "t", std::string{ 8, '\xf6' }),
+                                     false));
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+} // namespace
+
+int main()
+{
+    exact_values(false);
+    exact_values(true);
+    filtered_and_ignored_rows();
+    rotate();
+    unsupported_columns();
+}
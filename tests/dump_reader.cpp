@@ -0,0 +1,157 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "../src/dump.hpp"
+#include "check.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <zlib.h>
+
+extern "C"
+{
+#include <unistd.h>
+}
+
+namespace
+{
+void write_file(const std::filesystem::path& path, const std::string& content)
+{
+    std::ofstream(path) << content;
+}
+
+void write_gzip(const std::filesystem::path& path, const std::string& content)
+{
+    auto file = gzopen(path.c_str(), "wb");
+    CHECK(file != nullptr);
+    CHECK(gzwrite(file, content.data(), static_cast<unsigned>(content.size())) ==
+          static_cast<int>(content.size()));
+    CHECK(gzclose(file) == Z_OK);
+}
+
+std::vector<dump::row> read_all(dump::Reader& reader)
+{
+    std::vector<dump::row> rows;
+    for (auto batch = reader.next(); !batch.empty(); batch = reader.next())
+    {
+        rows.insert(rows.end(), batch.begin(), batch.end());
+    }
+    return rows;
+}
+
+// a dump set of one table in the layout of MySQL Shell, with gzip compressed chunks
+std::filesystem::path make_dump()
+{
+    auto directory = std::filesystem::temp_directory_path() /
+                     ("hta_import_test_dump_" + std::to_string(::getpid()));
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    write_file(directory / "@.done.json", "{}");
+    write_file(directory / "db@metric.json",
+               R"({"options": {"schema": "db", "table": "metric",
+                   "columns": ["id", "timestamp", "value"]},
+                   "compression": "gzip", "extension": "tsv.gz"})");
+    // the second chunk overlaps the first one, the third one follows them
+    write_gzip(directory / "db@metric@0.tsv.gz", "1\t1000\t1.5\n2\t3000\t3.5\n3\t5000\t5.5\n");
+    write_gzip(directory / "db@metric@1.tsv.gz", "4\t4000\t4.5\n5\t6000\t6.5\n");
+    write_gzip(directory / "db@metric@@2.tsv.gz", "6\t8000\t8.5\n7\t7000\t7.5\n");
+    // not part of the table
+    write_gzip(directory / "db@other@0.tsv.gz", "1\t2000\t0\n");
+    return directory;
+}
+
+void test_find_table(const std::filesystem::path& directory)
+{
+    auto table = dump::find_table(directory, "db", "metric");
+    CHECK(table.compression == "gzip");
+    CHECK(table.timestamp_column == 1);
+    CHECK(table.value_column == 2);
+    CHECK(table.chunks.size() == 3);
+    CHECK(table.chunks[0].filename() == "db@metric@0.tsv.gz");
+    CHECK(table.chunks[2].filename() == "db@metric@@2.tsv.gz");
+}
+
+void test_merge(const std::filesystem::path& directory)
+{
+    dump::Reader reader(dump::find_table(directory, "", "metric"), 2, 0, 0);
+    auto rows = read_all(reader);
+    std::vector<uint64_t> expected{ 1000, 3000, 4000, 5000, 6000, 7000, 8000 };
+    CHECK(rows.size() == expected.size());
+    for (std::size_t i = 0; i < rows.size(); i++)
+    {
+        CHECK(rows[i].timestamp == expected[i]);
+        CHECK(rows[i].value == static_cast<double>(expected[i]) / 1000 + 0.5);
+    }
+    CHECK(reader.merged_chunks() == 1);
+    CHECK(reader.compressed_bytes() > 0);
+}
+
+void test_range(const std::filesystem::path& directory)
+{
+    dump::Reader reader(dump::find_table(directory, "db", "metric"), 1, 3000, 7000);
+    auto rows = read_all(reader);
+    CHECK(rows.size() == 4);
+    CHECK(rows.front().timestamp == 3000);
+    CHECK(rows.back().timestamp == 6000);
+}
+
+void test_incomplete(const std::filesystem::path& directory)
+{
+    std::filesystem::remove(directory / "@.done.json");
+    bool thrown = false;
+    try
+    {
+        dump::find_table(directory, "db", "metric");
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+} // namespace
+
+int main()
+{
+    auto directory = make_dump();
+    test_find_table(directory);
+    test_merge(directory);
+    test_range(directory);
+    test_incomplete(directory);
+    std::filesystem::remove_all(directory);
+    return EXIT_SUCCESS;
+}
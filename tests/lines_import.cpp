@@ -0,0 +1,211 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "../src/lines.hpp"
+#include "check.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+extern "C"
+{
+#include <unistd.h>
+}
+
+namespace
+{
+struct value
+{
+    std::size_t metric;
+    lines::point point;
+};
+
+std::vector<value> parse(const nlohmann::json& config,
+                         const std::unordered_map<std::string, std::size_t>& metrics,
+                         const std::string& text)
+{
+    std::vector<value> values;
+    lines::Parser parser(config, metrics,
+                         [&values](std::size_t metric, lines::point p) {
+                             values.push_back({ metric, p });
+                         });
+    parser.feed(text);
+    return values;
+}
+
+template <typename F>
+bool throws(F f)
+{
+    try
+    {
+        f();
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+    return false;
+}
+
+void test_rule()
+{
+    lines::Rule rule("{measurement}.{host}.{field}");
+    auto name = rule.apply("cpu", "usage", { { "host", "node1" }, { "core", "0" } });
+    CHECK(name && *name == "cpu.node1.usage");
+    CHECK(!rule.apply("cpu", "usage", { { "core", "0" } }));
+}
+
+void test_influx()
+{
+    nlohmann::json config = { { "precision", "ms" }, { "name", "{measurement}.{host}.{field}" } };
+    std::unordered_map<std::string, std::size_t> metrics = { { "cpu load.a,b.usage", 0 },
+                                                             { "cpu load.a,b.idle", 1 },
+                                                             { "cpu load.a,b.state", 2 } };
+    std::vector<value> values;
+    lines::Parser parser(config, metrics, [&values](std::size_t metric, lines::point p) {
+        values.push_back({ metric, p });
+    });
+    parser.feed("# comment\n"
+                "cpu\\ load,host=a\\,b usage=0.5,idle=7i,state=\"ok\",up=t 1500\r\n"
+                "cpu\\ load,host=c usage=1 2000\n"
+                "cpu\\ load,host=a\\,b usage=nan 3000\n");
+    CHECK(parser.lines() == 3);
+    CHECK(values.size() == 2);
+    CHECK(values[0].metric == 0 && values[0].point.value == 0.5);
+    CHECK(values[0].point.time == 1500 * 1000000LL);
+    CHECK(values[1].metric == 1 && values[1].point.value == 7);
+    // the string and the NaN, the boolean and the value of host c are not mapped
+    CHECK(parser.skipped_values() == 2);
+    CHECK(parser.unmapped_values() == 2);
+    CHECK(parser.series() == 5);
+
+    CHECK(throws([&]() { parser.feed("cpu\\ load,host=a\\,b usage=1\n"); }));
+    CHECK(throws([&]() { parser.feed("cpu\\ load,host=a\\,b usage=1x 1000\n"); }));
+}
+
+void test_openmetrics()
+{
+    nlohmann::json config = { { "format", "openmetrics" }, { "name", "{measurement}.{method}" } };
+    std::unordered_map<std::string, std::size_t> metrics = { { "http_requests.post", 0 } };
+    auto values = parse(config, metrics,
+                        "# TYPE http_requests counter\n"
+                        "http_requests{method=\"post\",code=\"200\"} 1027 1395066363\n"
+                        "http_requests{method=\"get\"} 12 1395066363\n"
+                        "http_requests{method=\"post\",code=\"500\"} 3e1 1395066364 # {} 1\n");
+    CHECK(values.size() == 2);
+    CHECK(values[0].point.value == 1027);
+    CHECK(values[0].point.time == 1395066363LL * 1000000000LL);
+    CHECK(values[1].point.value == 30);
+    CHECK(values[1].point.time == 1395066364LL * 1000000000LL);
+
+    CHECK(throws([&]() { parse(config, metrics, "http_requests{method=\"post\"} 1\n"); }));
+    CHECK(throws([&]() { parse(config, metrics, "http_requests{method=\"post\" 1 2\n"); }));
+}
+
+// Both files go through the spill files, as the memory only holds a few values per thread.
+// The merge must restore the timestamp order, drop duplicates and skip extreme values.
+void test_import()
+{
+    auto directory = std::filesystem::temp_directory_path() /
+                     ("hta_import_test_lines_" + std::to_string(::getpid()));
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory / "hta");
+
+    auto first = directory / "first.lp";
+    auto second = directory / "second.lp";
+    std::ofstream(first) << "cpu,host=a usage=1.5 3000\n"
+                            "cpu,host=a usage=0.5 1000\n"
+                            "cpu,host=b usage=2 2000\n"
+                            "cpu,host=a usage=3e12 4000\n"
+                            "cpu,host=a usage=2.5 2000\n"
+                            "mem,host=a used=1i 1000\n";
+    std::ofstream(second) << "cpu,host=a usage=4.5 5000\n"
+                             "cpu,host=a usage=1.5 3000\n";
+
+    auto metric = [](const std::string& name) {
+        return nlohmann::json{ { "name", name },
+                               { "mode", "RW" },
+                               { "interval_min", 10000000 },
+                               { "interval_max", 1000000000000 },
+                               { "interval_factor", 10 } };
+    };
+    nlohmann::json config = {
+        { "path", (directory / "hta").string() },
+        { "metrics", { metric("cpu.a.usage"), metric("cpu.b.usage"), metric("cpu.c.usage") } },
+        { "line_protocol", { { "precision", "ms" }, { "name", "{measurement}.{host}.{field}" } } }
+    };
+
+    lines::options options;
+    options.files = { first.string(), second.string() };
+    options.threads = 2;
+    options.memory = 4 * sizeof(lines::point);
+    options.spill_directory = directory.string();
+    shard_options shard_options;
+    shard_options.shards = 2;
+    Status status;
+    auto reports = lines::import(config, options, shard_options, status);
+
+    std::unordered_map<std::string, import_report> by_metric;
+    for (const auto& report : reports)
+    {
+        CHECK(report.error.empty());
+        by_metric[report.metric] = report;
+    }
+    CHECK(by_metric.size() == 2);
+    // the duplicate and the extreme value are read, but not written
+    CHECK(by_metric["cpu.a.usage"].rows == 6);
+    CHECK(by_metric["cpu.a.usage"].extreme_values == 1);
+    CHECK(by_metric["cpu.b.usage"].rows == 1);
+    CHECK(by_metric["cpu.b.usage"].extreme_values == 0);
+    CHECK(by_metric["cpu.a.usage"].to_json()["extreme_values"] == 1);
+    // every two values of a thread spill, whichever thread parses which file
+    CHECK(by_metric["cpu.a.usage"].spilled_runs == 3);
+    CHECK(by_metric["cpu.b.usage"].spilled_runs == 1);
+
+    std::filesystem::remove_all(directory);
+}
+} // namespace
+
+int main()
+{
+    test_rule();
+    test_influx();
+    test_openmetrics();
+    test_import();
+    return EXIT_SUCCESS;
+}
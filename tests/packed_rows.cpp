@@ -0,0 +1,93 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "../src/import.hpp"
+#include "check.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+using values = std::vector<std::pair<uint64_t, double>>;
+
+values decode(const std::string& row, uint64_t count, uint64_t begin)
+{
+    values result;
+    decode_packed_row(row, count, begin,
+                      [&result](uint64_t timestamp, double value) {
+                          result.emplace_back(timestamp, value);
+                      });
+    return result;
+}
+
+void test_decode()
+{
+    CHECK(decode("0 1.5 10 -2 25 3e3", 3, 1000) ==
+          values({ { 1000, 1.5 }, { 1010, -2 }, { 1025, 3000 } }));
+    CHECK(decode("", 0, 0).empty());
+}
+
+void test_null()
+{
+    // COUNT(*) includes the rows whose value is NULL, so they must be part of the packed text,
+    // as 0 like in the plain mode
+    CHECK(packed_query("t").find("IFNULL(value, 0)") != std::string::npos);
+    CHECK(decode("0 1.5 10 0 20 2.5", 3, 0) ==
+          values({ { 0, 1.5 }, { 10, 0 }, { 20, 2.5 } }));
+}
+
+void test_truncated()
+{
+    bool thrown = false;
+    try
+    {
+        // group_concat_max_len cut off the last value
+        decode("0 1.5 10 2", 3, 0);
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+} // namespace
+
+int main()
+{
+    test_decode();
+    test_null();
+    test_truncated();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+// Copyright (c) 2018, ZIH,
+// Technische Universitaet Dresden,
+// Federal Republic of Germany
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright notice,
+//       this list of conditions and the following disclaimer in the documentation
+//       and/or other materials provided with the distribution.
+//     * Neither the name of metricq nor the names of its contributors
+//       may be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "../src/profile.hpp"
+#include "check.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+namespace
+{
+bool near(double actual, double expected, double relative)
+{
+    return std::abs(actual - expected) <= relative * std::abs(expected);
+}
+
+void test_quantiles()
+{
+    profile::QuantileSketch sketch;
+    for (int i = 1; i <= 100000; i++)
+    {
+        sketch.add(i);
+    }
+    CHECK(sketch.count() == 100000);
+    // the relative accuracy, plus a little for the rank of the quantile
+    CHECK(near(sketch.quantile(0.5), 50000, 0.011));
+    CHECK(near(sketch.quantile(0.99), 99000, 0.011));
+    CHECK(near(sketch.quantile(0), 1, 0.011));
+    CHECK(near(sketch.quantile(1), 100000, 0.011));
+
+    profile::QuantileSketch mixed;
+    for (int i = -1000; i <= 1000; i++)
+    {
+        mixed.add(i / 10.0);
+    }
+    CHECK(mixed.quantile(0.5) == 0);
+    CHECK(near(mixed.quantile(0.1), -80, 0.011));
+    CHECK(near(mixed.quantile(0.9), 80, 0.011));
+}
+
+void test_distinct()
+{
+    profile::DistinctSketch few;
+    for (int round = 0; round < 1000; round++)
+    {
+        for (int i = 0; i < 10; i++)
+        {
+            few.add(i * 0.5);
+        }
+    }
+    CHECK(std::llround(few.estimate()) == 10);
+
+    profile::DistinctSketch many;
+    for (int i = 0; i < 200000; i++)
+    {
+        many.add(i * 0.25);
+    }
+    // about three standard errors
+    CHECK(near(many.estimate(), 200000, 0.05));
+}
+
+hta::TimePoint at(double seconds)
+{
+    return hta::TimePoint(hta::duration_cast(std::chrono::duration<double>(seconds)));
+}
+
+void test_profile()
+{
+    profile::Profile profile;
+    double t = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        // one gap of 100 intervals
+        t += i == 500 ? 100 : 1;
+        profile.add({ at(t), static_cast<double>(i % 4) });
+    }
+    auto json = profile.to_json();
+    CHECK(json["count"] == 1000);
+    CHECK(json["min"] == 0);
+    CHECK(json["max"] == 3);
+    CHECK(json["mean"] == 1.5);
+    CHECK(json["distinct_values"] == 4);
+    CHECK(near(json["interval"]["quantiles"]["0.5"].get<double>(), 1, 0.011));
+    CHECK(json["gaps"]["count"] == 1);
+    CHECK(near(json["gaps"]["seconds"].get<double>(), 100, 1e-9));
+    CHECK(json["gaps"]["largest"].size() == 1);
+    CHECK(json["gaps"]["largest"][0]["seconds"] == 100);
+
+    CHECK(profile::Profile().to_json() == nlohmann::json({ { "count", 0 } }));
+
+    profile::Profile broken;
+    broken.add({ at(1), std::nan("") });
+    broken.add({ at(2), 2 });
+    broken.add({ at(3), HUGE_VAL });
+    json = broken.to_json();
+    CHECK(json["count"] == 1);
+    CHECK(json["non_finite_values"] == 2);
+    CHECK(json["min"] == 2);
+    CHECK(json["max"] == 2);
+}
+} // namespace
+
+int main()
+{
+    test_quantiles();
+    test_distinct();
+    test_profile();
+    return EXIT_SUCCESS;
+}
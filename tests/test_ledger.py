@@ -0,0 +1,267 @@
+# metricq
+# Copyright (C) 2019 ZIH,
+# Technische Universitaet Dresden,
+# Federal Republic of Germany
+#
+# All rights reserved.
+#
+# This file is part of metricq.
+#
+# metricq is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# metricq is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with metricq.  If not, see <http://www.gnu.org/licenses/>.
+
+
+import asyncio
+import json
+import os
+import tempfile
+import threading
+import unittest
+from unittest import mock
+
+from metricq_import.ledger import ImportLedger
+
+
+class FakeImportDatabase(object):
+    """The part of a cloudant database the ledger uses, with CouchDB revisions."""
+
+    def __init__(self, docs=()):
+        self.docs = {doc["_id"]: dict(doc) for doc in docs}
+        self.bulk_requests = []
+
+    def all_docs(self, keys, include_docs=False):
+        rows = []
+        for key in keys:
+            doc = self.docs.get(key)
+            if doc is None:
+                rows.append({"key": key, "error": "not_found"})
+                continue
+            row = {"id": key, "key": key, "value": {"rev": doc["_rev"]}}
+            if include_docs:
+                row["doc"] = dict(doc)
+            rows.append(row)
+        return {"rows": rows}
+
+    def bulk_docs(self, docs):
+        self.bulk_requests.append(docs)
+        results = []
+        for doc in docs:
+            stored = self.docs.get(doc["_id"])
+            if (stored and stored["_rev"]) != doc.get("_rev"):
+                results.append({"id": doc["_id"], "error": "conflict"})
+                continue
+            generation = int(stored["_rev"].split("-")[0]) + 1 if stored else 1
+            doc = dict(doc, _rev=f"{generation}-x")
+            self.docs[doc["_id"]] = doc
+            results.append({"id": doc["_id"], "rev": doc["_rev"]})
+        return results
+
+
+class FlakyImportDatabase(FakeImportDatabase):
+    """Fails the given number of bulk requests, as CouchDB does on a timeout."""
+
+    def __init__(self, docs=(), failures=1):
+        super().__init__(docs)
+        self.failures = failures
+
+    def bulk_docs(self, docs):
+        if self.failures:
+            self.failures -= 1
+            raise RuntimeError("503 Service Unavailable")
+        return super().bulk_docs(docs)
+
+
+class ImportLedgerTest(unittest.TestCase):
+    def setUp(self):
+        directory = tempfile.TemporaryDirectory()
+        self.addCleanup(directory.cleanup)
+        self.journal = os.path.join(directory.name, "import.journal")
+
+    def ledger(self, db):
+        return ImportLedger(db, self.journal, interval=0.01)
+
+    def write_journal(self, *docs, torn=False):
+        with open(self.journal, "w") as journal:
+            for doc in docs:
+                journal.write(json.dumps(doc) + "\n")
+            if torn:
+                journal.write('{"_id": "c", "return')
+
+    def test_replay(self):
+        db = FakeImportDatabase([{"_id": "a", "_rev": "1-x", "begin": 1}])
+        # the begin record of b and the end record of a, then a torn line of a crash
+        self.write_journal(
+            {"_id": "b", "begin": 2},
+            {"_id": "a", "begin": 1, "return_code": 0},
+            torn=True,
+        )
+        ledger = self.ledger(db)
+        ledger.load(["a", "b", "c"])
+
+        self.assertEqual(ledger.get("a")["return_code"], 0)
+        self.assertEqual(ledger.get("a")["_rev"], "1-x")
+        self.assertNotIn("return_code", ledger.get("b"))
+        self.assertIsNone(ledger.get("c"))
+
+        async def flush():
+            task = asyncio.create_task(ledger.run())
+            await asyncio.sleep(0)
+            ledger.stop()
+            await task
+
+        asyncio.run(flush())
+        self.assertEqual(db.docs["a"]["return_code"], 0)
+        self.assertEqual(db.docs["a"]["_rev"], "2-x")
+        self.assertEqual(db.docs["b"]["begin"], 2)
+        self.assertFalse(os.path.exists(self.journal))
+
+    def test_journal_until_stored(self):
+        db = FakeImportDatabase()
+        ledger = self.ledger(db)
+        ledger.load(["a", "b"])
+
+        async def update():
+            await ledger.create({"_id": "a", "begin": 1})
+            await ledger.create({"_id": "b", "begin": 2})
+            await ledger.put({"_id": "a", "begin": 1, "return_code": 0})
+
+        asyncio.run(update())
+        # a crash before the first flush, the next run replays the journal
+        self.assertEqual(db.docs, {})
+        replayed = self.ledger(db)
+        replayed.load(["a", "b"])
+        self.assertEqual(replayed.get("a"), {"_id": "a", "begin": 1, "return_code": 0})
+        self.assertEqual(replayed.get("b"), {"_id": "b", "begin": 2})
+
+    def test_group_commit(self):
+        db = FakeImportDatabase()
+        ledger = self.ledger(db)
+        ledger.load([])
+
+        async def update():
+            await asyncio.gather(
+                *(ledger.create({"_id": str(i), "begin": i}) for i in range(50))
+            )
+
+        with mock.patch("os.fsync") as fsync:
+            asyncio.run(update())
+        self.assertGreaterEqual(fsync.call_count, 1)
+        self.assertLess(fsync.call_count, 50)
+        with open(self.journal) as journal:
+            self.assertEqual(len(journal.readlines()), 50)
+
+    def test_fresh_run_keeps_conflict(self):
+        db = FakeImportDatabase([{"_id": "a", "_rev": "1-x", "return_code": 0}])
+        ledger = self.ledger(db)
+        ledger.load(["a", "b"])
+
+        async def update():
+            with self.assertRaises(RuntimeError):
+                await ledger.create({"_id": "a", "begin": 1})
+            await ledger.create({"_id": "b", "begin": 2})
+            # someone else creates b before the flush
+            db.docs["b"] = {"_id": "b", "_rev": "1-y", "begin": 3}
+            task = asyncio.create_task(ledger.run())
+            await asyncio.sleep(0)
+            ledger.stop()
+            await task
+
+        asyncio.run(update())
+        self.assertEqual(db.docs["a"], {"_id": "a", "_rev": "1-x", "return_code": 0})
+        self.assertEqual(db.docs["b"]["begin"], 3)
+
+    def test_update_takes_over_revision(self):
+        db = FakeImportDatabase([{"_id": "a", "_rev": "1-x", "begin": 1}])
+        ledger = self.ledger(db)
+        ledger.load(["a"])
+
+        async def update():
+            doc = ledger.get("a")
+            doc["return_code"] = 0
+            await ledger.put(doc)
+            # changed concurrently, the update is retried on top of it
+            db.docs["a"] = {"_id": "a", "_rev": "2-y", "begin": 1}
+            task = asyncio.create_task(ledger.run())
+            await asyncio.sleep(0)
+            ledger.stop()
+            await task
+
+        asyncio.run(update())
+        self.assertEqual(db.docs["a"]["return_code"], 0)
+        self.assertEqual(db.docs["a"]["_rev"], "3-x")
+
+    def test_retry_failed_write(self):
+        db = FlakyImportDatabase(failures=2)
+        ledger = self.ledger(db)
+        ledger.load(["a"])
+
+        async def update():
+            task = asyncio.create_task(ledger.run())
+            await ledger.create({"_id": "a", "begin": 1})
+            while db.failures:
+                await asyncio.sleep(0.01)
+            ledger.stop()
+            await task
+
+        asyncio.run(update())
+        self.assertEqual(db.docs["a"]["begin"], 1)
+        self.assertFalse(os.path.exists(self.journal))
+
+    def test_failed_write_at_stop(self):
+        db = FlakyImportDatabase(failures=1)
+        ledger = self.ledger(db)
+        ledger.load(["a"])
+
+        async def update():
+            await ledger.create({"_id": "a", "begin": 1})
+            task = asyncio.create_task(ledger.run())
+            await asyncio.sleep(0)
+            ledger.stop()
+            await task
+
+        with self.assertRaises(RuntimeError):
+            asyncio.run(update())
+        replayed = self.ledger(FakeImportDatabase())
+        replayed.load(["a"])
+        self.assertEqual(replayed.get("a"), {"_id": "a", "begin": 1})
+
+    def test_update_during_compaction(self):
+        db = FakeImportDatabase()
+        ledger = self.ledger(db)
+        ledger.load(["a", "b"])
+
+        async def update():
+            # holds back the journal thread until both updates and the compaction are queued
+            gate = threading.Event()
+            loop = asyncio.get_running_loop()
+            blocked = loop.run_in_executor(ledger._journal_executor, gate.wait)
+            a = asyncio.create_task(ledger.create({"_id": "a", "begin": 1}))
+            await asyncio.sleep(0)
+            flush = asyncio.create_task(ledger._flush())
+            while ledger._deferred is None:
+                await asyncio.sleep(0.001)
+            b = asyncio.create_task(ledger.create({"_id": "b", "begin": 2}))
+            await asyncio.sleep(0)
+            gate.set()
+            await asyncio.gather(blocked, a, flush, b)
+
+        asyncio.run(update())
+        # a crash after both updates were acknowledged, b is not stored yet
+        self.assertNotIn("b", db.docs)
+        replayed = self.ledger(db)
+        replayed.load(["a", "b"])
+        self.assertEqual(replayed.get("b"), {"_id": "b", "begin": 2})
+
+
+if __name__ == "__main__":
+    unittest.main()